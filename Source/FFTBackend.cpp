@@ -0,0 +1,332 @@
+/*
+  ==============================================================================
+
+    Pluggable real-FFT backends used by the partitioned convolution engine.
+
+  ==============================================================================
+*/
+
+#include "FFTBackend.h"
+
+#if CONVOLUTION_USE_FFTW
+ #include <fftw3.h>
+#endif
+
+#if CONVOLUTION_USE_PFFFT
+ #include <pffft.h>
+#endif
+
+//==============================================================================
+std::shared_ptr<const FFTPlan> FFTBackend::getPlan (int order)
+{
+    const std::lock_guard<std::mutex> lock (planLock);
+
+    auto& plan = plans[order];
+
+    if (plan == nullptr)
+        plan = createPlan (order);
+
+    return plan;
+}
+
+//==============================================================================
+namespace
+{
+    /** juce::dsp::FFT works in place on 2 * size floats. JUCE's own fallback
+        engine serialises concurrent calls on one instance with a lock, so every
+        Scratch carries an FFT of its own and callers never contend.
+    */
+    class JuceFFTPlan  : public FFTPlan
+    {
+    public:
+        explicit JuceFFTPlan (int fftOrder) : FFTPlan (fftOrder) {}
+
+        std::unique_ptr<Scratch> createScratch() const override
+        {
+            return std::make_unique<JuceScratch> (getOrder(), getScratchSize());
+        }
+
+        void forward (const float* input, Complex* output, Scratch& scratch) const noexcept override
+        {
+            auto* data = scratch.getData();
+
+            juce::FloatVectorOperations::copy (data, input, getSize());
+            getFFT (scratch).performRealOnlyForwardTransform (data, true);
+            std::copy_n (reinterpret_cast<const Complex*> (data), getNumBins(), output);
+        }
+
+        void inverse (const Complex* input, float* output, Scratch& scratch) const noexcept override
+        {
+            auto* data = scratch.getData();
+            auto* bins = reinterpret_cast<Complex*> (data);
+            const auto size = getSize();
+
+            std::copy_n (input, getNumBins(), bins);
+
+            for (auto i = getNumBins(); i < size; ++i)
+                bins[i] = std::conj (bins[size - i]);
+
+            getFFT (scratch).performRealOnlyInverseTransform (data);
+            juce::FloatVectorOperations::copy (output, data, size);
+        }
+
+    protected:
+        int getScratchSize() const noexcept override   { return 2 * getSize(); }
+
+    private:
+        struct JuceScratch  : public Scratch
+        {
+            JuceScratch (int fftOrder, int numFloats) : Scratch (numFloats), fft (fftOrder) {}
+
+            const juce::dsp::FFT fft;
+        };
+
+        static const juce::dsp::FFT& getFFT (Scratch& scratch) noexcept
+        {
+            return static_cast<JuceScratch&> (scratch).fft;
+        }
+    };
+
+    class JuceFFTBackend  : public FFTBackend
+    {
+    public:
+        const char* getName() const noexcept override   { return "JUCE"; }
+
+    protected:
+        std::unique_ptr<FFTPlan> createPlan (int order) override
+        {
+            return std::make_unique<JuceFFTPlan> (order);
+        }
+    };
+
+   #if CONVOLUTION_USE_FFTW
+    /** The FFTW planner isn't thread safe, executing a plan on new arrays is. */
+    std::mutex fftwPlannerLock;
+
+    class FFTWPlan  : public FFTPlan
+    {
+    public:
+        explicit FFTWPlan (int fftOrder) : FFTPlan (fftOrder)
+        {
+            const std::lock_guard<std::mutex> lock (fftwPlannerLock);
+
+            auto* real = fftwf_alloc_real ((size_t) getSize());
+            auto* bins = fftwf_alloc_complex ((size_t) getNumBins());
+
+            forwardPlan = fftwf_plan_dft_r2c_1d (getSize(), real, bins, FFTW_MEASURE | FFTW_UNALIGNED);
+            inversePlan = fftwf_plan_dft_c2r_1d (getSize(), bins, real, FFTW_MEASURE | FFTW_UNALIGNED);
+
+            fftwf_free (real);
+            fftwf_free (bins);
+        }
+
+        ~FFTWPlan() override
+        {
+            const std::lock_guard<std::mutex> lock (fftwPlannerLock);
+
+            fftwf_destroy_plan (forwardPlan);
+            fftwf_destroy_plan (inversePlan);
+        }
+
+        void forward (const float* input, Complex* output, Scratch& scratch) const noexcept override
+        {
+            juce::ignoreUnused (scratch);
+
+            // out-of-place r2c transforms preserve their input
+            fftwf_execute_dft_r2c (forwardPlan, const_cast<float*> (input), reinterpret_cast<fftwf_complex*> (output));
+        }
+
+        void inverse (const Complex* input, float* output, Scratch& scratch) const noexcept override
+        {
+            // c2r transforms destroy their input, so work on a copy
+            auto* bins = reinterpret_cast<Complex*> (scratch.getData());
+
+            std::copy_n (input, getNumBins(), bins);
+            fftwf_execute_dft_c2r (inversePlan, reinterpret_cast<fftwf_complex*> (bins), output);
+            juce::FloatVectorOperations::multiply (output, 1.0f / (float) getSize(), getSize());
+        }
+
+    protected:
+        int getScratchSize() const noexcept override   { return 2 * getNumBins(); }
+
+    private:
+        fftwf_plan forwardPlan = nullptr, inversePlan = nullptr;
+    };
+
+    class FFTWBackend  : public FFTBackend
+    {
+    public:
+        const char* getName() const noexcept override   { return "FFTW"; }
+
+    protected:
+        std::unique_ptr<FFTPlan> createPlan (int order) override
+        {
+            return std::make_unique<FFTWPlan> (order);
+        }
+    };
+   #endif
+
+   #if CONVOLUTION_USE_PFFFT
+    /** PFFFT needs 16-byte aligned buffers and packs the real Nyquist bin
+        into the imaginary part of the DC bin.
+    */
+    class PFFFTPlan  : public FFTPlan
+    {
+    public:
+        explicit PFFFTPlan (int fftOrder)
+            : FFTPlan (fftOrder), setup (pffft_new_setup (getSize(), PFFFT_REAL))
+        {
+            jassert (setup != nullptr);
+        }
+
+        ~PFFFTPlan() override
+        {
+            pffft_destroy_setup (setup);
+        }
+
+        void forward (const float* input, Complex* output, Scratch& scratch) const noexcept override
+        {
+            const auto size = getSize();
+            auto* data = align (scratch.getData());
+            auto* work = data + size;
+
+            juce::FloatVectorOperations::copy (data, input, size);
+            pffft_transform_ordered (setup, data, data, work, PFFFT_FORWARD);
+
+            output[0] = { data[0], 0.0f };
+            output[size / 2] = { data[1], 0.0f };
+            std::copy_n (reinterpret_cast<const Complex*> (data) + 1, size / 2 - 1, output + 1);
+        }
+
+        void inverse (const Complex* input, float* output, Scratch& scratch) const noexcept override
+        {
+            const auto size = getSize();
+            auto* data = align (scratch.getData());
+            auto* work = data + size;
+
+            std::copy_n (input + 1, size / 2 - 1, reinterpret_cast<Complex*> (data) + 1);
+            data[0] = input[0].real();
+            data[1] = input[size / 2].real();
+
+            pffft_transform_ordered (setup, data, data, work, PFFFT_BACKWARD);
+            juce::FloatVectorOperations::multiply (output, data, 1.0f / (float) size, size);
+        }
+
+    protected:
+        int getScratchSize() const noexcept override   { return 3 * getSize() + 4; }
+
+    private:
+        static float* align (float* p) noexcept
+        {
+            return reinterpret_cast<float*> ((reinterpret_cast<std::uintptr_t> (p) + 15) & ~(std::uintptr_t) 15);
+        }
+
+        PFFFT_Setup* const setup;
+    };
+
+    class PFFFTBackend  : public FFTBackend
+    {
+    public:
+        const char* getName() const noexcept override   { return "PFFFT"; }
+
+    protected:
+        std::unique_ptr<FFTPlan> createPlan (int order) override
+        {
+            return std::make_unique<PFFFTPlan> (order);
+        }
+    };
+   #endif
+}
+
+const std::vector<FFTBackend*>& FFTBackend::getAvailableBackends()
+{
+   #if CONVOLUTION_USE_FFTW
+    static FFTWBackend fftw;
+   #endif
+   #if CONVOLUTION_USE_PFFFT
+    static PFFFTBackend pffft;
+   #endif
+    static JuceFFTBackend juceFFT;
+
+    static const std::vector<FFTBackend*> backends {
+       #if CONVOLUTION_USE_FFTW
+        &fftw,
+       #endif
+       #if CONVOLUTION_USE_PFFFT
+        &pffft,
+       #endif
+        &juceFFT
+    };
+
+    return backends;
+}
+
+FFTBackend& FFTBackend::getDefault()
+{
+    return *getAvailableBackends().front();
+}
+
+//==============================================================================
+double FFTCalibration::measure (FFTBackend& backend, int order, int iterations)
+{
+    const auto plan = backend.getPlan (order);
+
+    std::vector<float> samples ((size_t) plan->getSize());
+    std::vector<FFTPlan::Complex> bins ((size_t) plan->getNumBins());
+    const auto scratch = plan->createScratch();
+
+    juce::Random random;
+
+    for (auto& s : samples)
+        s = random.nextFloat() * 2.0f - 1.0f;
+
+    // warm up the caches and the plan
+    for (auto i = 0; i < 8; ++i)
+    {
+        plan->forward (samples.data(), bins.data(), *scratch);
+        plan->inverse (bins.data(), samples.data(), *scratch);
+    }
+
+    const auto start = juce::Time::getMillisecondCounterHiRes();
+
+    for (auto i = 0; i < iterations; ++i)
+    {
+        plan->forward (samples.data(), bins.data(), *scratch);
+        plan->inverse (bins.data(), samples.data(), *scratch);
+    }
+
+    return (juce::Time::getMillisecondCounterHiRes() - start) * 1000.0 / iterations;
+}
+
+void FFTCalibration::run (const std::vector<int>& orders, const std::vector<FFTBackend*>& backends, int iterations)
+{
+    for (auto order : orders)
+    {
+        if (results.find (order) != results.end())
+            continue;
+
+        Result best { nullptr, std::numeric_limits<double>::max() };
+
+        for (auto* backend : backends)
+        {
+            const auto microseconds = measure (*backend, order, iterations);
+
+            if (microseconds < best.microseconds)
+                best = { backend, microseconds };
+        }
+
+        results[order] = best;
+    }
+}
+
+FFTBackend& FFTCalibration::getBackendFor (int order) const
+{
+    const auto it = results.find (order);
+    return it != results.end() ? *it->second.backend : FFTBackend::getDefault();
+}
+
+double FFTCalibration::getMicrosecondsFor (int order) const
+{
+    const auto it = results.find (order);
+    return it != results.end() ? it->second.microseconds : -1.0;
+}
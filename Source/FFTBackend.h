@@ -0,0 +1,168 @@
+/*
+  ==============================================================================
+
+    Pluggable real-FFT backends used by the partitioned convolution engine.
+
+    Backends are selected at compile time:
+      CONVOLUTION_USE_FFTW=1         links against single precision FFTW3 (fftw3f)
+      CONVOLUTION_USE_PFFFT=1        requires pffft.c / pffft.h on the include path
+      CONVOLUTION_FFT_CALIBRATION=1  picks the fastest of them at startup
+    juce::dsp::FFT is always available as the fallback.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <complex>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#ifndef CONVOLUTION_USE_FFTW
+ #define CONVOLUTION_USE_FFTW 0
+#endif
+
+#ifndef CONVOLUTION_USE_PFFFT
+ #define CONVOLUTION_USE_PFFFT 0
+#endif
+
+/** When enabled, prepareToPlay() times every available backend at the engine's
+    FFT size and picks the fastest one, instead of the preferred default.
+*/
+#ifndef CONVOLUTION_FFT_CALIBRATION
+ #define CONVOLUTION_FFT_CALIBRATION 0
+#endif
+
+//==============================================================================
+/**
+    A planned real transform of a fixed power-of-two size.
+
+    Spectra are always exchanged as size/2 + 1 interleaved complex bins, whatever
+    the native layout of the backend, and the inverse transform is scaled by
+    1/size so that all backends are interchangeable.
+
+    A plan is immutable once created, so it can be shared between threads. Each
+    caller passes its own Scratch, made by createScratch(), which holds the
+    working memory and whatever per-thread state the backend needs.
+*/
+class FFTPlan
+{
+public:
+    using Complex = std::complex<float>;
+
+    explicit FFTPlan (int fftOrder) : order (fftOrder), size (1 << fftOrder) {}
+    virtual ~FFTPlan() = default;
+
+    int getOrder() const noexcept   { return order; }
+    int getSize() const noexcept    { return size; }
+    int getNumBins() const noexcept { return size / 2 + 1; }
+
+    /** Working memory for forward() and inverse(). A Scratch must only be used
+        with the plan that created it, and by one thread at a time.
+    */
+    class Scratch
+    {
+    public:
+        explicit Scratch (int numFloats) : data ((size_t) numFloats) {}
+        virtual ~Scratch() = default;
+
+        float* getData() noexcept   { return data.data(); }
+
+    private:
+        std::vector<float> data;
+
+        JUCE_DECLARE_NON_COPYABLE (Scratch)
+    };
+
+    /** Allocates a Scratch for one caller, not for the audio thread. */
+    virtual std::unique_ptr<Scratch> createScratch() const     { return std::make_unique<Scratch> (getScratchSize()); }
+
+    /** Transforms size real samples into size/2 + 1 bins. */
+    virtual void forward (const float* input, Complex* output, Scratch& scratch) const noexcept = 0;
+
+    /** Transforms size/2 + 1 bins into size real samples, scaled by 1/size. */
+    virtual void inverse (const Complex* input, float* output, Scratch& scratch) const noexcept = 0;
+
+protected:
+    /** Number of floats of working memory needed by forward() and inverse(). */
+    virtual int getScratchSize() const noexcept = 0;
+
+private:
+    const int order, size;
+
+    JUCE_DECLARE_NON_COPYABLE (FFTPlan)
+};
+
+//==============================================================================
+/**
+    Creates FFTPlans for one FFT library, and caches them per size so that
+    expensive planning (FFTW_MEASURE for instance) only happens once.
+*/
+class FFTBackend
+{
+public:
+    virtual ~FFTBackend() = default;
+
+    virtual const char* getName() const noexcept = 0;
+
+    /** Returns the cached plan for a transform of 2^order samples, creating it
+        if needed. Planning may allocate, so don't call this on the audio thread.
+    */
+    std::shared_ptr<const FFTPlan> getPlan (int order);
+
+    /** All the backends compiled into this build, the preferred one first. */
+    static const std::vector<FFTBackend*>& getAvailableBackends();
+
+    /** The preferred backend, used when no calibration has been done. */
+    static FFTBackend& getDefault();
+
+protected:
+    virtual std::unique_ptr<FFTPlan> createPlan (int order) = 0;
+
+private:
+    std::mutex planLock;
+    std::map<int, std::shared_ptr<const FFTPlan>> plans;
+};
+
+//==============================================================================
+/**
+    Startup calibration: times every available backend at the given FFT orders
+    and remembers the fastest one for each size.
+*/
+class FFTCalibration
+{
+public:
+    /** Runs the benchmark for the orders that haven't been measured yet. This
+        takes a few milliseconds per backend and size.
+    */
+    void run (const std::vector<int>& orders,
+              const std::vector<FFTBackend*>& backends = FFTBackend::getAvailableBackends(),
+              int iterations = 200);
+
+    /** Returns the fastest backend measured for this order, or the default
+        backend if that order wasn't calibrated.
+    */
+    FFTBackend& getBackendFor (int order) const;
+
+    /** Returns the measured time of a forward + inverse pair, in microseconds,
+        or a negative value if that order wasn't calibrated.
+    */
+    double getMicrosecondsFor (int order) const;
+
+    /** Times a forward + inverse transform pair of one backend, in microseconds. */
+    static double measure (FFTBackend& backend, int order, int iterations);
+
+private:
+    struct Result
+    {
+        FFTBackend* backend;
+        double microseconds;
+    };
+
+    std::map<int, Result> results;
+};
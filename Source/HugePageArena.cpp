@@ -0,0 +1,210 @@
+/*
+  ==============================================================================
+
+    One contiguous, page-locked and pre-faulted block of memory for the big
+    buffers of the convolution engine (filter spectra and delay lines).
+
+  ==============================================================================
+*/
+
+#include "HugePageArena.h"
+
+#if JUCE_WINDOWS
+ #include <windows.h>
+ #include <psapi.h>
+ #pragma comment (lib, "psapi.lib")
+#else
+ #include <sys/mman.h>
+ #include <unistd.h>
+ #if JUCE_MAC
+  #include <mach/vm_statistics.h>
+ #endif
+#endif
+
+namespace
+{
+    constexpr size_t hugePageSize = 2 * 1024 * 1024;
+
+    size_t roundUp (size_t numBytes, size_t granularity) noexcept
+    {
+        return (numBytes + granularity - 1) / granularity * granularity;
+    }
+
+    size_t getPageSize() noexcept
+    {
+       #if JUCE_WINDOWS
+        SYSTEM_INFO info;
+        GetSystemInfo (&info);
+        return (size_t) info.dwPageSize;
+       #else
+        return (size_t) sysconf (_SC_PAGESIZE);
+       #endif
+    }
+}
+
+//==============================================================================
+HugePageArena::~HugePageArena()
+{
+    release();
+}
+
+void HugePageArena::allocate (size_t numBytes)
+{
+    release();
+
+    if (numBytes == 0)
+        return;
+
+    const juce::ScopedLock sl (mappingLock);
+
+    size = numBytes;
+
+   #if JUCE_WINDOWS
+    // large pages need SeLockMemoryPrivilege, which plugins practically never have
+    mappedSize = roundUp (numBytes, getPageSize());
+    data = VirtualAlloc (nullptr, mappedSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    pageKind = PageKind::normal;
+   #else
+    auto tryMap = [this] (size_t bytes, int flags, int fd) -> bool
+    {
+        auto* p = mmap (nullptr, bytes, PROT_READ | PROT_WRITE, flags, fd, 0);
+
+        if (p == MAP_FAILED)
+            return false;
+
+        data = p;
+        mappedSize = bytes;
+        return true;
+    };
+
+    const auto hugeSize = roundUp (numBytes, hugePageSize);
+
+   #if JUCE_LINUX || JUCE_ANDROID
+    if (tryMap (hugeSize, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1))
+    {
+        pageKind = PageKind::explicitHuge;
+    }
+    else if (tryMap (hugeSize, MAP_PRIVATE | MAP_ANONYMOUS, -1))
+    {
+        pageKind = madvise (data, mappedSize, MADV_HUGEPAGE) == 0 ? PageKind::transparentHuge
+                                                                  : PageKind::normal;
+    }
+   #elif JUCE_MAC && defined (VM_FLAGS_SUPERPAGE_SIZE_2MB)
+    // superpages only exist on Intel Macs, Apple silicon refuses the flag
+    if (tryMap (hugeSize, MAP_PRIVATE | MAP_ANON, VM_FLAGS_SUPERPAGE_SIZE_2MB))
+        pageKind = PageKind::explicitHuge;
+   #endif
+
+    if (data == nullptr && tryMap (roundUp (numBytes, getPageSize()), MAP_PRIVATE | MAP_ANON, -1))
+        pageKind = PageKind::normal;
+   #endif
+
+    if (data == nullptr)
+    {
+        jassertfalse;
+        size = 0;
+        return;
+    }
+
+    // fault every page in now rather than on the first audio blocks
+    std::memset (data, 0, mappedSize);
+
+   #if JUCE_WINDOWS
+    locked = VirtualLock (data, mappedSize) != 0;
+   #else
+    locked = mlock (data, mappedSize) == 0;
+   #endif
+}
+
+void HugePageArena::release()
+{
+    const juce::ScopedLock sl (mappingLock);
+
+    if (data != nullptr)
+    {
+       #if JUCE_WINDOWS
+        if (locked)
+            VirtualUnlock (data, mappedSize);
+
+        VirtualFree (data, 0, MEM_RELEASE);
+       #else
+        if (locked)
+            munlock (data, mappedSize);
+
+        munmap (data, mappedSize);
+       #endif
+    }
+
+    data = nullptr;
+    size = mappedSize = used = 0;
+    pageKind = PageKind::none;
+    locked = false;
+}
+
+//==============================================================================
+size_t HugePageArena::countResidentBytes() const
+{
+    if (data == nullptr)
+        return 0;
+
+    const auto pageSize = getPageSize();
+
+   #if JUCE_WINDOWS
+    std::vector<PSAPI_WORKING_SET_EX_INFORMATION> pages (mappedSize / pageSize);
+
+    for (size_t i = 0; i < pages.size(); ++i)
+        pages[i].VirtualAddress = static_cast<char*> (data) + i * pageSize;
+
+    if (! QueryWorkingSetEx (GetCurrentProcess(), pages.data(), (DWORD) (pages.size() * sizeof (pages[0]))))
+        return mappedSize;
+
+    size_t numResident = 0;
+
+    for (auto& page : pages)
+        if (page.VirtualAttributes.Valid != 0)
+            ++numResident;
+
+    return numResident * pageSize;
+   #else
+   #if JUCE_MAC
+    std::vector<char> pages (mappedSize / pageSize);
+   #else
+    std::vector<unsigned char> pages (mappedSize / pageSize);
+   #endif
+
+    if (mincore (data, mappedSize, pages.data()) != 0)
+        return mappedSize;
+
+    size_t numResident = 0;
+
+    for (auto page : pages)
+        if ((page & 1) != 0)
+            ++numResident;
+
+    return numResident * pageSize;
+   #endif
+}
+
+HugePageArena::Footprint HugePageArena::getFootprint() const
+{
+    const juce::ScopedLock sl (mappingLock);
+
+    Footprint footprint;
+    footprint.mappedBytes = mappedSize;
+    footprint.residentBytes = countResidentBytes();
+    footprint.pageKind = pageKind;
+    footprint.locked = locked;
+    return footprint;
+}
+
+const char* HugePageArena::getPageKindName (PageKind kind) noexcept
+{
+    switch (kind)
+    {
+        case PageKind::explicitHuge:    return "huge pages";
+        case PageKind::transparentHuge: return "transparent huge pages";
+        case PageKind::normal:          return "normal pages";
+        case PageKind::none:
+        default:                        return "not allocated";
+    }
+}
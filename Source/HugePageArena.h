@@ -0,0 +1,105 @@
+/*
+  ==============================================================================
+
+    One contiguous, page-locked and pre-faulted block of memory for the big
+    buffers of the convolution engine (filter spectra and delay lines).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    Allocates memory backed by huge pages when the system has them, locks it into
+    RAM and touches every page up front, so that the audio thread never takes a
+    page fault and needs far fewer TLB entries to walk the filter spectra.
+
+    It tries, in order:
+      - explicit huge pages (MAP_HUGETLB on Linux, superpages on Intel macOS)
+      - transparent huge pages (madvise MADV_HUGEPAGE on Linux)
+      - normal pages
+    and falls back silently when mlock isn't allowed (RLIMIT_MEMLOCK).
+
+    Memory is handed out with take(), a bump allocator that keeps everything
+    cache-line aligned. Nothing is freed until the next allocate() or release().
+*/
+class HugePageArena
+{
+public:
+    enum class PageKind
+    {
+        none,
+        normal,
+        transparentHuge,
+        explicitHuge
+    };
+
+    HugePageArena() = default;
+    ~HugePageArena();
+
+    /** Maps, locks and zero-fills at least numBytes, releasing the previous block. */
+    void allocate (size_t numBytes);
+
+    /** Unlocks and unmaps the memory. */
+    void release();
+
+    /** Returns the next numElements of T, aligned to a cache line. */
+    template <typename T>
+    T* take (size_t numElements) noexcept
+    {
+        const auto offset = (used + alignment - 1) & ~(alignment - 1);
+        const auto numBytes = numElements * sizeof (T);
+
+        jassert (offset + numBytes <= size);
+        used = offset + numBytes;
+
+        return reinterpret_cast<T*> (static_cast<char*> (data) + offset);
+    }
+
+    /** How many bytes to request for a list of buffers handed out with take(). */
+    static size_t getPaddedSize (size_t numBytes) noexcept    { return (numBytes + alignment - 1) & ~(alignment - 1); }
+
+    //==============================================================================
+    /** The mapping and how much of it is in RAM at the time it was taken. */
+    struct Footprint
+    {
+        size_t mappedBytes = 0, residentBytes = 0;
+        PageKind pageKind = PageKind::none;
+        bool locked = false;
+
+        /** The footprint of two arenas together, with the smaller of their page kinds. */
+        Footprint combinedWith (const Footprint& other) const noexcept
+        {
+            if (other.pageKind == PageKind::none)  return *this;
+            if (pageKind == PageKind::none)        return other;
+
+            return { mappedBytes + other.mappedBytes, residentBytes + other.residentBytes,
+                     juce::jmin (pageKind, other.pageKind), locked && other.locked };
+        }
+    };
+
+    /** Asks the OS which pages are resident right now, so pages lost after a
+        failed lock show up. This allocates, keep it off the audio thread.
+    */
+    Footprint getFootprint() const;
+
+    static const char* getPageKindName (PageKind kind) noexcept;
+
+private:
+    static constexpr size_t alignment = 64;
+
+    size_t countResidentBytes() const;
+
+    /** Keeps getFootprint() from looking at a mapping while it changes. */
+    juce::CriticalSection mappingLock;
+
+    void* data = nullptr;
+    size_t size = 0, mappedSize = 0, used = 0;
+    PageKind pageKind = PageKind::none;
+    bool locked = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HugePageArena)
+};
@@ -0,0 +1,323 @@
+/*
+  ==============================================================================
+
+    Uniformly partitioned, frequency-domain convolution of every input with
+    every output, i.e. a numInputs x numOutputs filter matrix.
+
+  ==============================================================================
+*/
+
+#include "MatrixConvolver.h"
+
+//==============================================================================
+MatrixConvolver::MatrixConvolver (int numIns, int numOuts)
+    : numInputs (numIns), numOutputs (numOuts), outputs ((size_t) numOuts)
+{
+}
+
+void MatrixConvolver::prepare (int newPartitionSize, int maxFilterLength, FFTBackend& backend, int numWorkers)
+{
+    jassert (juce::isPowerOfTwo (newPartitionSize));
+
+    partitionSize = newPartitionSize;
+    numBins = partitionSize + 1;
+    numPartitions = juce::jmax (1, (maxFilterLength + partitionSize - 1) / partitionSize);
+
+    // blocks are zero padded to twice the partition size, so that the linear
+    // convolution with a partition doesn't wrap around
+    plan = backend.getPlan (juce::roundToInt (std::log2 (2 * partitionSize)));
+
+    // the Nyquist bin gets a range of its own, so the ranges shrink with the
+    // partition to keep that padding small
+    binsPerRange = juce::jlimit (8, 64, partitionSize / 16);
+    numBinRanges = (numBins + binsPerRange - 1) / binsPerRange;
+
+    // a tile keeps a tail and an accumulator row per output, plus the rows of one
+    // input group, in half the cache each. More tiles than workers let them all
+    // finish at about the same time.
+    const auto rowSize = (size_t) binsPerRange * sizeof (Complex);
+    const auto outputsPerTile = juce::jmax (1, (int) (cacheSize / 2 / (2 * rowSize)));
+    const auto inputsPerGroup = juce::jmax (1, (int) (cacheSize / 2 / rowSize));
+
+    numOutputGroups = juce::jlimit (1, numOutputs, juce::jmax ((numOutputs + outputsPerTile - 1) / outputsPerTile,
+                                                               (4 * numWorkers + numBinRanges - 1) / numBinRanges));
+    numInputGroups = (numInputs + inputsPerGroup - 1) / inputsPerGroup;
+
+    const auto fftSize = (size_t) plan->getSize();
+    const auto spectrumSize = (size_t) numBins;
+    const auto paddedSpectrumSize = (size_t) (numBinRanges * binsPerRange);
+
+    const auto numFilterBins = (size_t) (numOutputs * numInputs * numPartitions) * paddedSpectrumSize;
+    numInputSpectrumBins = (size_t) (numInputs * numPartitions) * paddedSpectrumSize;
+
+    // the arena comes back zeroed, locked and pre-faulted. A bin range is at
+    // least 64 bytes, so the tiles that other cores run never share a cache line.
+    arena.allocate (HugePageArena::getPaddedSize (numFilterBins * sizeof (Complex))
+                      + HugePageArena::getPaddedSize (numInputSpectrumBins * sizeof (Complex))
+                      + 2 * outputs.size() * HugePageArena::getPaddedSize (paddedSpectrumSize * sizeof (Complex)));
+
+    filterSpectra = arena.take<Complex> (numFilterBins);
+    inputSpectra = arena.take<Complex> (numInputSpectrumBins);
+
+    inputSamples.assign ((size_t) numInputs * fftSize, 0.0f);
+    inputScratch = plan->createScratch();
+    inputSpectrum.assign (spectrumSize, {});
+
+    for (auto& state : outputs)
+    {
+        state.tail = arena.take<Complex> (paddedSpectrumSize);
+        state.accumulator = arena.take<Complex> (paddedSpectrumSize);
+        state.spectrum.assign (spectrumSize, {});
+        state.samples.assign (fftSize, 0.0f);
+        state.overlap.assign ((size_t) partitionSize, 0.0f);
+        state.scratch = plan->createScratch();
+    }
+
+    reset();
+}
+
+void MatrixConvolver::reset()
+{
+    std::fill_n (inputSpectra, numInputSpectrumBins, Complex());
+    std::fill (inputSamples.begin(), inputSamples.end(), 0.0f);
+
+    for (auto& state : outputs)
+        std::fill (state.overlap.begin(), state.overlap.end(), 0.0f);
+
+    inputPosition = 0;
+    numSamplesPushed = 0;
+    currentSlot = 0;
+}
+
+void MatrixConvolver::release()
+{
+    arena.release();
+    filterSpectra = inputSpectra = nullptr;
+    numInputSpectrumBins = 0;
+
+    inputSamples = {};
+    inputScratch.reset();
+    inputSpectrum = {};
+
+    for (auto& state : outputs)
+        state = {};
+
+    plan.reset();
+    partitionSize = numBins = numPartitions = 0;
+    binsPerRange = numBinRanges = 0;
+    numOutputGroups = numInputGroups = 1;
+    inputPosition = numSamplesPushed = currentSlot = 0;
+}
+
+void MatrixConvolver::setFilter (int output, int input, const float* impulse, int length)
+{
+    jassert (plan != nullptr);
+    jassert (length <= numPartitions * partitionSize);
+
+    auto& state = outputs[(size_t) output];
+    auto* padded = state.samples.data();
+
+    for (auto partition = 0; partition < numPartitions; ++partition)
+    {
+        const auto start = partition * partitionSize;
+        const auto numToCopy = juce::jlimit (0, partitionSize, length - start);
+
+        juce::FloatVectorOperations::clear (padded, plan->getSize());
+
+        if (numToCopy > 0)
+            juce::FloatVectorOperations::copy (padded, impulse + start, numToCopy);
+
+        plan->forward (padded, state.spectrum.data(), *state.scratch);
+        storeSpectrum (state.spectrum.data(), getFilter (partition, 0, output, input),
+                       (size_t) (numOutputs * numInputs * binsPerRange));
+    }
+
+    juce::FloatVectorOperations::clear (padded, plan->getSize());
+}
+
+void MatrixConvolver::storeSpectrum (const Complex* spectrum, Complex* firstRow, size_t rangeStride) const noexcept
+{
+    // the padding after the Nyquist bin is never written, so it stays zero
+    for (auto range = 0; range < numBinRanges; ++range)
+        std::copy_n (spectrum + range * binsPerRange, juce::jmin (binsPerRange, numBins - range * binsPerRange),
+                     firstRow + (size_t) range * rangeStride);
+}
+
+//==============================================================================
+void MatrixConvolver::pushInputs (const juce::dsp::AudioBlock<float>& inputs)
+{
+    jassert ((int) inputs.getNumChannels() >= numInputs);
+    jassert ((int) inputs.getNumSamples() <= getNumSamplesUntilBoundary());
+
+    numSamplesPushed = (int) inputs.getNumSamples();
+
+    CONVOLUTION_TRACE_SCOPE ("forward FFT");
+
+    for (auto input = 0; input < numInputs; ++input)
+    {
+        auto* samples = inputSamples.data() + (size_t) input * (size_t) plan->getSize();
+
+        juce::FloatVectorOperations::copy (samples + inputPosition, inputs.getChannelPointer ((size_t) input), numSamplesPushed);
+        plan->forward (samples, inputSpectrum.data(), *inputScratch);
+        storeSpectrum (inputSpectrum.data(), getInputSpectrum (currentSlot, 0, input), (size_t) (numInputs * binsPerRange));
+    }
+}
+
+void MatrixConvolver::processTile (int tile) noexcept
+{
+    CONVOLUTION_TRACE_SCOPE ("MAC", tile);
+
+    const auto range = tile % numBinRanges;
+    const auto group = tile / numBinRanges;
+    const auto firstOutput = numOutputs * group / numOutputGroups;
+    const auto endOutput = numOutputs * (group + 1) / numOutputGroups;
+    const auto firstBin = (size_t) (range * binsPerRange);
+
+    // the older partitions only change when a new partition starts
+    if (inputPosition == 0)
+    {
+        for (auto output = firstOutput; output < endOutput; ++output)
+            std::fill_n (outputs[(size_t) output].tail + firstBin, binsPerRange, Complex());
+
+        for (auto partition = 1; partition < numPartitions; ++partition)
+            multiplyAccumulateTile (partition, (currentSlot + partition) % numPartitions, range, firstOutput, endOutput, true);
+    }
+
+    for (auto output = firstOutput; output < endOutput; ++output)
+    {
+        auto& state = outputs[(size_t) output];
+        std::copy_n (state.tail + firstBin, binsPerRange, state.accumulator + firstBin);
+    }
+
+    multiplyAccumulateTile (0, currentSlot, range, firstOutput, endOutput, false);
+}
+
+void MatrixConvolver::multiplyAccumulateTile (int partition, int slot, int range, int firstOutput, int endOutput, bool intoTail) noexcept
+{
+    const auto firstBin = (size_t) (range * binsPerRange);
+
+    // the rows of an input group are read from memory once and then come from
+    // the cache for every other output of the tile
+    for (auto group = 0; group < numInputGroups; ++group)
+    {
+        const auto firstInput = numInputs * group / numInputGroups;
+        const auto endInput = numInputs * (group + 1) / numInputGroups;
+
+        for (auto output = firstOutput; output < endOutput; ++output)
+        {
+            auto& state = outputs[(size_t) output];
+            auto* accumulator = (intoTail ? state.tail : state.accumulator) + firstBin;
+
+            for (auto input = firstInput; input < endInput; ++input)
+                multiplyAccumulate (getInputSpectrum (slot, range, input), getFilter (partition, range, output, input),
+                                    accumulator, binsPerRange);
+        }
+    }
+}
+
+void MatrixConvolver::processOutput (int output, float* destination) noexcept
+{
+    auto& state = outputs[(size_t) output];
+
+    {
+        CONVOLUTION_TRACE_SCOPE ("inverse FFT", output);
+        plan->inverse (state.accumulator, state.samples.data(), *state.scratch);
+    }
+
+    juce::FloatVectorOperations::add (destination, state.samples.data() + inputPosition,
+                                      state.overlap.data() + inputPosition, numSamplesPushed);
+
+    if (inputPosition + numSamplesPushed == partitionSize)
+        juce::FloatVectorOperations::copy (state.overlap.data(), state.samples.data() + partitionSize, partitionSize);
+}
+
+void MatrixConvolver::advance() noexcept
+{
+    inputPosition += numSamplesPushed;
+    numSamplesPushed = 0;
+
+    if (inputPosition == partitionSize)
+    {
+        inputPosition = 0;
+        currentSlot = (currentSlot > 0) ? (currentSlot - 1) : (numPartitions - 1);
+
+        for (auto input = 0; input < numInputs; ++input)
+            juce::FloatVectorOperations::clear (inputSamples.data() + (size_t) input * (size_t) plan->getSize(), partitionSize);
+    }
+}
+
+//==============================================================================
+int MatrixConvolver::findFastestPartitionSize (int numIns, int numOuts, int filterLength,
+                                               int minSize, int maxSize, const FFTCalibration& calibration,
+                                               double blockOverheadMicroseconds)
+{
+    const auto nanosecondsPerBin = measureMultiplyAccumulate();
+
+    maxSize = juce::jlimit (minSize, juce::jmax (minSize, maxSize), juce::nextPowerOfTwo (filterLength));
+
+    auto bestSize = minSize;
+    auto bestCost = std::numeric_limits<double>::max();
+
+    for (auto size = minSize; size <= maxSize; size *= 2)
+    {
+        const auto order = juce::roundToInt (std::log2 (2 * size));
+        const auto partitions = juce::jmax (1, (filterLength + size - 1) / size);
+
+        // one forward transform per input and one inverse per output, each about half a pair
+        const auto fftMicroseconds = calibration.getMicrosecondsFor (order) * 0.5 * (numIns + numOuts);
+        const auto macMicroseconds = (double) numIns * numOuts * partitions * (size + 1) * nanosecondsPerBin * 1.0e-3;
+        const auto costPerSample = (fftMicroseconds + macMicroseconds + blockOverheadMicroseconds) / size;
+
+        if (costPerSample < bestCost)
+        {
+            bestCost = costPerSample;
+            bestSize = size;
+        }
+    }
+
+    return bestSize;
+}
+
+double MatrixConvolver::measureMultiplyAccumulate()
+{
+    // big enough not to fit in the caches, like the filter spectra of the matrix
+    constexpr int numBinsPerRow = 1025, numRows = 1024, numRuns = 4;
+
+    std::vector<Complex> filters ((size_t) (numBinsPerRow * numRows), Complex (0.5f, 0.25f));
+    std::vector<Complex> input ((size_t) numBinsPerRow, Complex (0.25f, 0.5f));
+    std::vector<Complex> accumulator ((size_t) numBinsPerRow);
+
+    auto best = std::numeric_limits<double>::max();
+
+    for (auto run = 0; run < numRuns; ++run)
+    {
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+
+        for (auto row = 0; row < numRows; ++row)
+            multiplyAccumulate (input.data(), filters.data() + (size_t) (row * numBinsPerRow), accumulator.data(), numBinsPerRow);
+
+        best = juce::jmin (best, juce::Time::getMillisecondCounterHiRes() - start);
+    }
+
+    // keeps the compiler from throwing the benchmark away
+    static volatile float sink = 0.0f;
+    sink = sink + accumulator.front().real();
+
+    return best * 1.0e6 / ((double) numBinsPerRow * numRows);
+}
+
+//==============================================================================
+void MatrixConvolver::multiplyAccumulate (const Complex* a, const Complex* b, Complex* accumulator, int numBins) noexcept
+{
+    // written on the raw floats so that the compiler can vectorise it, which it
+    // won't do with std::complex's operator* because of its NaN handling
+    auto* x = reinterpret_cast<const float*> (a);
+    auto* y = reinterpret_cast<const float*> (b);
+    auto* acc = reinterpret_cast<float*> (accumulator);
+
+    for (auto i = 0; i < 2 * numBins; i += 2)
+    {
+        acc[i]     += x[i] * y[i]     - x[i + 1] * y[i + 1];
+        acc[i + 1] += x[i] * y[i + 1] + x[i + 1] * y[i];
+    }
+}
@@ -0,0 +1,168 @@
+/*
+  ==============================================================================
+
+    Uniformly partitioned, frequency-domain convolution of every input with
+    every output, i.e. a numInputs x numOutputs filter matrix.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "FFTBackend.h"
+#include "HugePageArena.h"
+#include "TraceRecorder.h"
+
+//==============================================================================
+/**
+    Zero latency uniformly partitioned overlap-add convolver for a filter matrix.
+
+    Each input is transformed once per call and its spectrum is kept in a
+    frequency-domain delay line, so the forward FFTs are shared by all outputs.
+    Each output then accumulates the products of the delayed input spectra with
+    its filter partitions and needs a single inverse FFT.
+
+    The multiply-accumulate is cut into tiles of a bin range times a group of
+    outputs, which walk through the inputs a group at a time. The spectra are
+    stored bin-major, as rows of one bin range for every input, so a tile loads
+    the rows of an input group once and reuses them for all of its outputs,
+    while its accumulators stay in L1 and the filters stream past once.
+
+    Processing is split into four phases so that the caller can spread the
+    work over several threads:
+      pushInputs()    - audio thread, transforms the new input samples
+      processTile()   - once per tile, calls for different tiles may overlap
+      processOutput() - once per output after all the tiles, may overlap too
+      advance()       - audio thread, once all the outputs are done
+
+    The filter spectra and the delay lines live in a HugePageArena, so they're
+    locked in memory and already faulted in when the first block arrives.
+
+    A call never crosses a partition boundary: split the host block with
+    getNumSamplesUntilBoundary(). Blocks shorter than a partition are handled
+    like juce::dsp::Convolution does, by transforming the partial partition.
+*/
+class MatrixConvolver
+{
+public:
+    using Complex = FFTPlan::Complex;
+
+    MatrixConvolver (int numInputs, int numOutputs);
+
+    /** Allocates all the buffers. Filters must be set again after this. The
+        tiles are made small enough to keep numWorkers threads busy.
+    */
+    void prepare (int partitionSize, int maxFilterLength, FFTBackend& backend, int numWorkers = 1);
+
+    /** Clears the delay lines and the overlap buffers. */
+    void reset();
+
+    /** Frees the memory, prepare() must be called again before processing. */
+    void release();
+
+    /** Partitions and transforms the filter between one input and one output.
+        This allocates nothing but isn't meant for the audio thread either.
+    */
+    void setFilter (int output, int input, const float* impulse, int length);
+
+    int getPartitionSize() const noexcept              { return partitionSize; }
+    int getNumPartitions() const noexcept              { return numPartitions; }
+    int getNumSamplesUntilBoundary() const noexcept    { return partitionSize - inputPosition; }
+    int getNumTiles() const noexcept                   { return numBinRanges * numOutputGroups; }
+
+    /** The memory used by the filter spectra and the delay lines. */
+    HugePageArena::Footprint getMemoryFootprint() const    { return arena.getFootprint(); }
+
+    /** Appends numSamples of every input channel and transforms the partition. */
+    void pushInputs (const juce::dsp::AudioBlock<float>& inputs);
+
+    /** Multiply-accumulates one tile of the spectra from the last pushInputs() call. */
+    void processTile (int tile) noexcept;
+
+    /** Writes the samples of one output, once every tile has been processed. */
+    void processOutput (int output, float* destination) noexcept;
+
+    /** Moves on once every output has been processed. */
+    void advance() noexcept;
+
+    //==============================================================================
+    /** Picks the power-of-two partition size between minSize and maxSize with
+        the lowest CPU time per sample for this matrix and filter length.
+
+        The estimate combines the measured FFT times of the calibration, which
+        must cover every candidate order, a multiply-accumulate benchmark and
+        a fixed cost per block for dispatching the work to the threads.
+
+        Sizes beyond the next power of two of the filter length are never
+        picked: they only spread the fixed cost over more samples of latency.
+    */
+    static int findFastestPartitionSize (int numInputs, int numOutputs, int filterLength,
+                                         int minSize, int maxSize, const FFTCalibration& calibration,
+                                         double blockOverheadMicroseconds);
+
+    /** Times the complex multiply-accumulate, streaming the filters from memory
+        like the real matrix does. Returns nanoseconds per bin.
+    */
+    static double measureMultiplyAccumulate();
+
+private:
+    //==============================================================================
+    /** The L1 data cache of a core, which the tiles are sized for. */
+    static constexpr size_t cacheSize = 32 * 1024;
+
+    /** Filters are stored [partition][bin range][output][input][bin]. */
+    Complex* getFilter (int partition, int range, int output, int input) noexcept
+    {
+        return filterSpectra + ((((size_t) partition * (size_t) numBinRanges + (size_t) range) * (size_t) numOutputs
+                                  + (size_t) output) * (size_t) numInputs + (size_t) input) * (size_t) binsPerRange;
+    }
+
+    /** Input spectra are stored [slot][bin range][input][bin]. */
+    Complex* getInputSpectrum (int slot, int range, int input) noexcept
+    {
+        return inputSpectra + (((size_t) slot * (size_t) numBinRanges + (size_t) range) * (size_t) numInputs
+                                 + (size_t) input) * (size_t) binsPerRange;
+    }
+
+    /** Scatters a contiguous spectrum into rows that are rangeStride bins apart. */
+    void storeSpectrum (const Complex* spectrum, Complex* firstRow, size_t rangeStride) const noexcept;
+
+    /** Adds one partition of a tile to the tails or to the accumulators of its outputs. */
+    void multiplyAccumulateTile (int partition, int slot, int range, int firstOutput, int endOutput, bool intoTail) noexcept;
+
+    static void multiplyAccumulate (const Complex* a, const Complex* b, Complex* accumulator, int numBins) noexcept;
+
+    //==============================================================================
+    const int numInputs, numOutputs;
+
+    int partitionSize = 0, numBins = 0, numPartitions = 0;
+    int binsPerRange = 0, numBinRanges = 0, numOutputGroups = 1, numInputGroups = 1;
+    int inputPosition = 0, numSamplesPushed = 0, currentSlot = 0;
+
+    std::shared_ptr<const FFTPlan> plan;
+
+    HugePageArena arena;
+    Complex* filterSpectra = nullptr;
+    Complex* inputSpectra = nullptr;
+    size_t numInputSpectrumBins = 0;
+    std::vector<float> inputSamples;
+    std::vector<Complex> inputSpectrum;
+    std::unique_ptr<FFTPlan::Scratch> inputScratch;
+
+    /** Everything an output needs, so that outputs never share memory. The
+        tiles of an output write disjoint bin ranges of its accumulators, which
+        come from the arena so that every range starts on a cache line of its own.
+    */
+    struct OutputState
+    {
+        Complex* tail = nullptr;
+        Complex* accumulator = nullptr;
+        std::vector<Complex> spectrum;
+        std::vector<float> samples, overlap;
+        std::unique_ptr<FFTPlan::Scratch> scratch;
+    };
+
+    std::vector<OutputState> outputs;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MatrixConvolver)
+};
@@ -0,0 +1,286 @@
+/*
+  ==============================================================================
+
+    Filter matrix convolution with the late part of every filter running at a
+    reduced sample rate.
+
+  ==============================================================================
+*/
+
+#include "MultirateConvolver.h"
+
+//==============================================================================
+MultirateConvolver::MultirateConvolver (int numIns, int numOuts)
+    : numInputs (numIns), numOutputs (numOuts),
+      early (numIns, numOuts), tail (numIns, numOuts),
+      tailStates ((size_t) numOuts)
+{
+}
+
+void MultirateConvolver::prepare (int partitionSize, int maxFilterLength, int newSplitSamples, int decimationFactor,
+                                  const FFTCalibration& calibration, int numWorkers)
+{
+    jassert (decimationFactor == 2 || decimationFactor == 4);
+    jassert (partitionSize % decimationFactor == 0);
+
+    factor = decimationFactor;
+
+    // the split has to fall on a reduced rate sample, after the resampling delay
+    splitSamples = juce::jmax (getMinimumSplit (factor), newSplitSamples / factor * factor);
+    tailLength = juce::jmax (0, maxFilterLength - splitSamples);
+
+    const auto fftOrder = juce::roundToInt (std::log2 (2 * partitionSize));
+
+    if (tailLength == 0)
+    {
+        early.prepare (partitionSize, maxFilterLength, calibration.getBackendFor (fftOrder), numWorkers);
+        tail.release();
+        return;
+    }
+
+    early.prepare (partitionSize, splitSamples, calibration.getBackendFor (fftOrder), numWorkers);
+
+    lowpass = designLowpass (factor);
+    tailPartitionSize = partitionSize / factor;
+
+    // the low-pass spreads the end of the filter by half its length
+    const auto tailFilterLength = (tailLength + filterHalfLength * factor + factor - 1) / factor;
+    tail.prepare (tailPartitionSize, tailFilterLength, calibration.getBackendFor (fftOrder - juce::roundToInt (std::log2 (factor))),
+                  numWorkers);
+
+    decimationState.setSize (numInputs, (int) lowpass.size() - 1 + partitionSize);
+    decimated.setSize (numInputs, tailPartitionSize);
+
+    interpolationHistory = 2 * filterHalfLength;
+    alignmentDelay = (splitSamples - getMinimumSplit (factor)) / factor;
+
+    for (auto& state : tailStates)
+        state.samples.assign ((size_t) (interpolationHistory + alignmentDelay + tailPartitionSize), 0.0f);
+
+    reset();
+}
+
+void MultirateConvolver::reset()
+{
+    early.reset();
+
+    if (! hasReducedRateTail())
+        return;
+
+    tail.reset();
+    decimationState.clear();
+
+    for (auto& state : tailStates)
+        std::fill (state.samples.begin(), state.samples.end(), 0.0f);
+}
+
+void MultirateConvolver::setFilter (int output, int input, const float* impulse, int length)
+{
+    early.setFilter (output, input, impulse, juce::jmin (length, hasReducedRateTail() ? splitSamples : length));
+
+    if (! hasReducedRateTail())
+        return;
+
+    // a filter that ends before the split has a silent tail
+    if (length <= splitSamples)
+    {
+        tail.setFilter (output, input, nullptr, 0);
+        return;
+    }
+
+    // zero phase low-pass of the late part, sampled at the reduced rate. The
+    // factor makes up for the samples the reduced rate convolution skips.
+    const auto late = impulse + splitSamples;
+    const auto lateLength = length - splitSamples;
+    const auto centre = filterHalfLength * factor;
+
+    std::vector<float> reduced ((size_t) ((lateLength + centre + factor - 1) / factor));
+
+    for (size_t i = 0; i < reduced.size(); ++i)
+    {
+        const auto n = (int) i * factor;
+        auto sum = 0.0f;
+
+        for (auto k = juce::jmax (0, n + centre - lateLength + 1); k < (int) lowpass.size() && n + centre - k >= 0; ++k)
+            sum += lowpass[(size_t) k] * late[n + centre - k];
+
+        reduced[i] = sum * (float) factor;
+    }
+
+    tail.setFilter (output, input, reduced.data(), (int) reduced.size());
+}
+
+HugePageArena::Footprint MultirateConvolver::getMemoryFootprint() const
+{
+    auto footprint = early.getMemoryFootprint();
+
+    if (hasReducedRateTail())
+        footprint = footprint.combinedWith (tail.getMemoryFootprint());
+
+    return footprint;
+}
+
+//==============================================================================
+void MultirateConvolver::pushInputs (const juce::dsp::AudioBlock<float>& inputs)
+{
+    jassert ((int) inputs.getNumSamples() == getPartitionSize());
+
+    early.pushInputs (inputs);
+
+    if (! hasReducedRateTail())
+        return;
+
+    CONVOLUTION_TRACE_SCOPE ("decimate");
+
+    const auto numTaps = (int) lowpass.size();
+    const auto numSamples = getPartitionSize();
+
+    for (auto input = 0; input < numInputs; ++input)
+    {
+        auto* state = decimationState.getWritePointer (input);
+        auto* out = decimated.getWritePointer (input);
+
+        juce::FloatVectorOperations::copy (state + numTaps - 1, inputs.getChannelPointer ((size_t) input), numSamples);
+
+        // only every factor-th output of the low-pass is needed
+        for (auto m = 0; m < tailPartitionSize; ++m)
+        {
+            const auto* x = state + numTaps - 1 + m * factor;
+            auto sum = 0.0f;
+
+            for (auto k = 0; k < numTaps; ++k)
+                sum += lowpass[(size_t) k] * x[-k];
+
+            out[m] = sum;
+        }
+
+        std::memmove (state, state + numSamples, sizeof (float) * (size_t) (numTaps - 1));
+    }
+
+    tail.pushInputs (juce::dsp::AudioBlock<float> (decimated));
+}
+
+void MultirateConvolver::processTile (int tile) noexcept
+{
+    if (tile < early.getNumTiles())
+        early.processTile (tile);
+    else
+        tail.processTile (tile - early.getNumTiles());
+}
+
+void MultirateConvolver::processOutput (int output, float* destination) noexcept
+{
+    early.processOutput (output, destination);
+
+    if (! hasReducedRateTail())
+        return;
+
+    auto& samples = tailStates[(size_t) output].samples;
+
+    // the new reduced rate block goes behind the alignment delay
+    tail.processOutput (output, samples.data() + interpolationHistory + alignmentDelay);
+
+    CONVOLUTION_TRACE_SCOPE ("interpolate", output);
+
+    const auto numTaps = (int) lowpass.size();
+    const auto* current = samples.data() + interpolationHistory;
+
+    for (auto n = 0; n < getPartitionSize(); ++n)
+    {
+        const auto m = n / factor;
+        auto sum = 0.0f;
+
+        // polyphase form of zero stuffing followed by the low-pass
+        for (auto k = n % factor, q = 0; k < numTaps; k += factor, ++q)
+            sum += lowpass[(size_t) k] * current[m - q];
+
+        destination[n] += sum * (float) factor;
+    }
+
+    std::memmove (samples.data(), samples.data() + tailPartitionSize,
+                  sizeof (float) * (size_t) (interpolationHistory + alignmentDelay));
+}
+
+void MultirateConvolver::advance() noexcept
+{
+    early.advance();
+
+    if (hasReducedRateTail())
+        tail.advance();
+}
+
+//==============================================================================
+std::vector<float> MultirateConvolver::designLowpass (int decimationFactor)
+{
+    // Blackman windowed sinc, with the transition band ending at the reduced Nyquist frequency
+    const auto numTaps = 2 * filterHalfLength * decimationFactor + 1;
+    const auto cutoff = 0.5 / decimationFactor - 2.75 / numTaps;
+    const auto centre = (numTaps - 1) / 2;
+
+    std::vector<float> taps ((size_t) numTaps);
+    auto sum = 0.0;
+
+    for (auto n = 0; n < numTaps; ++n)
+    {
+        const auto x = 2.0 * cutoff * (n - centre);
+        const auto sinc = (n == centre) ? 1.0 : std::sin (juce::MathConstants<double>::pi * x) / (juce::MathConstants<double>::pi * x);
+        const auto phase = juce::MathConstants<double>::twoPi * n / (numTaps - 1);
+        const auto window = 0.42 - 0.5 * std::cos (phase) + 0.08 * std::cos (2.0 * phase);
+
+        taps[(size_t) n] = (float) (sinc * window);
+        sum += sinc * window;
+    }
+
+    for (auto& tap : taps)
+        tap = (float) (tap / sum);
+
+    return taps;
+}
+
+double MultirateConvolver::measureCrossoverError (const float* impulse, int length, int split, int decimationFactor)
+{
+    split = juce::jmax (getMinimumSplit (decimationFactor), split / decimationFactor * decimationFactor);
+
+    if (length <= split)
+        return -std::numeric_limits<double>::infinity();
+
+    // the tail goes through the low-pass three times: the input's decimation,
+    // the filter's own band limiting and the interpolation
+    const auto lowpass = designLowpass (decimationFactor);
+    std::vector<double> response { 1.0 };
+
+    for (auto pass = 0; pass < 3; ++pass)
+    {
+        std::vector<double> next (response.size() + lowpass.size() - 1, 0.0);
+
+        for (size_t i = 0; i < response.size(); ++i)
+            for (size_t k = 0; k < lowpass.size(); ++k)
+                next[i + k] += response[i] * lowpass[k];
+
+        response = std::move (next);
+    }
+
+    const auto* late = impulse + split;
+    const auto lateLength = length - split;
+    const auto centre = (int) response.size() / 2;
+
+    auto errorEnergy = 0.0, totalEnergy = 0.0;
+
+    for (auto n = 0; n < length; ++n)
+        totalEnergy += (double) impulse[n] * impulse[n];
+
+    for (auto n = 0; n < lateLength; ++n)
+    {
+        auto filtered = 0.0;
+
+        for (auto k = juce::jmax (0, n + centre - lateLength + 1); k < (int) response.size() && n + centre - k >= 0; ++k)
+            filtered += response[(size_t) k] * late[n + centre - k];
+
+        errorEnergy += juce::square (late[n] - filtered);
+    }
+
+    if (totalEnergy <= 0.0)
+        return -std::numeric_limits<double>::infinity();
+
+    return 10.0 * std::log10 (juce::jmax (errorEnergy / totalEnergy, 1.0e-30));
+}
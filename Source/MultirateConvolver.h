@@ -0,0 +1,106 @@
+/*
+  ==============================================================================
+
+    Filter matrix convolution with the late part of every filter running at a
+    reduced sample rate.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "MatrixConvolver.h"
+
+//==============================================================================
+/**
+    Splits every filter at splitSamples. The early part is convolved at the full
+    rate by one MatrixConvolver. The late part has hardly any high frequency
+    content in a room response, so it's low-passed, decimated by 2 or 4 and
+    convolved at the lower rate by a second MatrixConvolver whose partitions are
+    that much shorter. Its output is interpolated back and added to the early part.
+
+    The decimation and interpolation filters are linear phase, and their delay is
+    taken out of the split point, so the two parts line up without adding any
+    latency. The tail loses whatever the filter had above the reduced Nyquist
+    frequency, see measureCrossoverError().
+
+    Uses the same pushInputs() / processTile() / processOutput() / advance()
+    phases as MatrixConvolver, but always with whole partitions of the full
+    rate engine. The tiles of both engines are numbered one after the other.
+*/
+class MultirateConvolver
+{
+public:
+    using Complex = MatrixConvolver::Complex;
+
+    MultirateConvolver (int numInputs, int numOutputs);
+
+    /** Allocates everything. Filters no longer than splitSamples don't use the
+        reduced rate engine at all. The calibration must cover the FFT sizes of
+        both engines.
+    */
+    void prepare (int partitionSize, int maxFilterLength, int splitSamples, int decimationFactor,
+                  const FFTCalibration& calibration, int numWorkers = 1);
+
+    void reset();
+
+    /** Splits, band-limits and transforms the filter between one input and one output. */
+    void setFilter (int output, int input, const float* impulse, int length);
+
+    int getPartitionSize() const noexcept       { return early.getPartitionSize(); }
+    int getSplitSamples() const noexcept        { return splitSamples; }
+    bool hasReducedRateTail() const noexcept    { return tailLength > 0; }
+    int getNumTiles() const noexcept            { return early.getNumTiles() + (hasReducedRateTail() ? tail.getNumTiles() : 0); }
+
+    HugePageArena::Footprint getMemoryFootprint() const;
+
+    /** Transforms a whole partition of every input and decimates it for the tail. */
+    void pushInputs (const juce::dsp::AudioBlock<float>& inputs);
+
+    /** Multiply-accumulates one tile of either engine, calls may overlap. */
+    void processTile (int tile) noexcept;
+
+    /** Writes one output once all the tiles are done, calls for different outputs may overlap. */
+    void processOutput (int output, float* destination) noexcept;
+
+    void advance() noexcept;
+
+    //==============================================================================
+    /** The earliest split point possible, the delay of the resampling filters. */
+    static int getMinimumSplit (int decimationFactor) noexcept   { return 2 * filterHalfLength * decimationFactor; }
+
+    /** The energy the band-limited tail loses compared to the exact filter, in dB
+        relative to the energy of the whole filter. This is the error of the
+        output for a white input, or minus infinity when there's no tail.
+    */
+    static double measureCrossoverError (const float* impulse, int length, int splitSamples, int decimationFactor);
+
+private:
+    //==============================================================================
+    /** Half the length of the resampling filters, in samples at the reduced rate. */
+    static constexpr int filterHalfLength = 16;
+
+    static std::vector<float> designLowpass (int decimationFactor);
+
+    const int numInputs, numOutputs;
+
+    MatrixConvolver early, tail;
+
+    int splitSamples = 0, factor = 1, tailLength = 0;
+    int tailPartitionSize = 0, interpolationHistory = 0, alignmentDelay = 0;
+
+    std::vector<float> lowpass;
+
+    /** Per input: the last samples needed by the decimation filter, followed by the new block. */
+    juce::AudioBuffer<float> decimationState, decimated;
+
+    /** Per output: interpolation history, the alignment delay and the new tail block. */
+    struct TailState
+    {
+        std::vector<float> samples;
+    };
+
+    std::vector<TailState> tailStates;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MultirateConvolver)
+};
@@ -15,7 +15,7 @@ ConvolutionPluginAudioProcessorEditor::ConvolutionPluginAudioProcessorEditor (Co
 {
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (200, 200);
+    setSize (200, 240);
     
     // define parameters of the slider
     midiVolume.setSliderStyle(juce::Slider::LinearBarVertical);
@@ -28,14 +28,28 @@ ConvolutionPluginAudioProcessorEditor::ConvolutionPluginAudioProcessorEditor (Co
     // add slider to the editor
     addAndMakeVisible(&midiVolume);
     
-    // check box
+    // check boxes
     addAndMakeVisible(&reverbButton);
     
+    traceButton.setToggleState(audioProcessor.isTracing(), juce::dontSendNotification);
+    addAndMakeVisible(&traceButton);
+    
+    // the encoding filters instead of the room impulse response, if capsules.txt was accepted
+    encoderButton.setToggleState(audioProcessor.getFilterSource() == ConvolutionPluginAudioProcessor::FilterSource::encoder,
+                                 juce::dontSendNotification);
+    encoderButton.setEnabled(audioProcessor.isFilterSourceAvailable(ConvolutionPluginAudioProcessor::FilterSource::encoder));
+    addAndMakeVisible(&encoderButton);
+    
     // add the listener to the slider
     midiVolume.addListener(this);
     
-    // add the listener to the button
+    // add the listener to the buttons
     reverbButton.addListener(this);
+    traceButton.addListener(this);
+    encoderButton.addListener(this);
+    
+    // the memory footprint changes whenever the host prepares the processor
+    startTimerHz(1);
 }
 
 ConvolutionPluginAudioProcessorEditor::~ConvolutionPluginAudioProcessorEditor()
@@ -51,14 +65,31 @@ void ConvolutionPluginAudioProcessorEditor::paint (juce::Graphics& g)
     g.setColour (juce::Colours::white);
     g.setFont (15.0f);
     g.drawFittedText ("Output Volume", 0, 0, getWidth(), 30, juce::Justification::centred, 1);
+    
+    // resident size of the filter spectra and delay lines
+    auto footprint = audioProcessor.getMemoryFootprint();
+    auto memoryText = juce::String (footprint.residentBytes / (1024.0 * 1024.0), 1) + " MB, "
+                    + HugePageArena::getPageKindName (footprint.pageKind)
+                    + (footprint.locked ? ", locked" : "");
+    
+    // how much the reduced rate tail differs from the exact filter
+    auto tailError = audioProcessor.getTailCrossoverError();
+    auto tailText = std::isfinite (tailError) ? "Tail error " + juce::String (tailError, 1) + " dB"
+                                              : juce::String ("Tail at full rate");
+    
+    g.setFont (11.0f);
+    g.drawFittedText (memoryText + "\n" + tailText + "\n" + audioProcessor.getEncoderStatus(),
+                      0, getHeight() - 55, getWidth(), 50, juce::Justification::centred, 4);
 }
 
 void ConvolutionPluginAudioProcessorEditor::resized()
 {
     // set position and size of the slider
-    midiVolume.setBounds(40, 30, 20, getHeight() - 60);
+    midiVolume.setBounds(40, 30, 20, getHeight() - 95);
     
     reverbButton.setBounds(100, 50, 60, 20);
+    traceButton.setBounds(100, 80, 60, 20);
+    encoderButton.setBounds(100, 110, 80, 20);
     
 }
 
@@ -69,5 +100,32 @@ void ConvolutionPluginAudioProcessorEditor::sliderValueChanged(juce::Slider* sli
 
 void ConvolutionPluginAudioProcessorEditor::buttonClicked(juce::Button* button)
 {
+    if (button == &traceButton)
+    {
+        if (traceButton.getToggleState())
+            traceButton.setToggleState(audioProcessor.startTracing(), juce::dontSendNotification);
+        else
+            audioProcessor.stopTracing();
+        
+        return;
+    }
+    
+    if (button == &encoderButton)
+    {
+        using FilterSource = ConvolutionPluginAudioProcessor::FilterSource;
+        
+        auto source = encoderButton.getToggleState() ? FilterSource::encoder : FilterSource::roomImpulse;
+        
+        if (! audioProcessor.setFilterSource(source))
+            encoderButton.setToggleState(audioProcessor.getFilterSource() == FilterSource::encoder, juce::dontSendNotification);
+        
+        return;
+    }
+    
     audioProcessor.reverbOn = reverbButton.getToggleState();
 }
+
+void ConvolutionPluginAudioProcessorEditor::timerCallback()
+{
+    repaint();
+}
@@ -16,7 +16,8 @@
 */
 class ConvolutionPluginAudioProcessorEditor : public juce::AudioProcessorEditor,
                                               private juce::Slider::Listener,
-                                              private juce::ToggleButton::Listener
+                                              private juce::ToggleButton::Listener,
+                                              private juce::Timer
 {
 public:
     ConvolutionPluginAudioProcessorEditor (ConvolutionPluginAudioProcessor&);
@@ -29,6 +30,7 @@ public:
 private:
     void sliderValueChanged(juce::Slider* slider) override;
     void buttonClicked(juce::Button* button) override;
+    void timerCallback() override;
     
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
@@ -36,6 +38,8 @@ private:
     
     juce::Slider midiVolume;
     juce::ToggleButton reverbButton { "Reverb" };
+    juce::ToggleButton traceButton { "Trace" };
+    juce::ToggleButton encoderButton { "Encoder" };
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ConvolutionPluginAudioProcessorEditor)
 };
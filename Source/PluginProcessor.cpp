@@ -19,12 +19,12 @@ ConvolutionPluginAudioProcessor::ConvolutionPluginAudioProcessor()
                        .withOutput ("Output", juce::AudioChannelSet::ambisonic(ARRAY_ORDER), true)
                        ),
 #endif
-    messageQueue(100)
 {
-    auto numImpulses = ARRAY_MICROPHONES * ARRAY_HARMONICS;
-    for (auto i = 0; i < numImpulses; i++)
+    tracer.setLaneName(0, "audio thread");
+    
+    for (auto worker = 1; worker < numWorkers; worker++)
     {
-        convolvers.emplace_back( new juce::dsp::Convolution(juce::dsp::Convolution::Latency {256}, messageQueue) );
+        tracer.setLaneName(worker, "worker " + juce::String(worker));
     }
     
     auto dir = juce::File::getSpecialLocation(juce::File::userHomeDirectory);
@@ -34,14 +34,110 @@ ConvolutionPluginAudioProcessor::ConvolutionPluginAudioProcessor()
     while (! dir.getChildFile("dev").exists() && numTries++ < 15)
         dir = dir.getParentDirectory();
     
-    for (auto & convolver : convolvers)
+    auto resources = dir.getChildFile("dev").getChildFile("resources");
+    
+    loadImpulseResponse(resources.getChildFile("large_church.wav"));
+    loadEncoder(resources.getChildFile("capsules.txt"));
+    
+    if (! isFilterSourceAvailable(FilterSource::roomImpulse) && isFilterSourceAvailable(FilterSource::encoder))
+        filterSource = FilterSource::encoder;
+}
+
+ConvolutionPluginAudioProcessor::~ConvolutionPluginAudioProcessor()
+{
+}
+
+bool ConvolutionPluginAudioProcessor::startTracing()
+{
+    auto name = "ConvolutionPlugin-trace-" + juce::Time::getCurrentTime().formatted("%Y%m%d-%H%M%S") + ".json";
+    return tracer.start(juce::File::getSpecialLocation(juce::File::userDesktopDirectory).getChildFile(name));
+}
+
+void ConvolutionPluginAudioProcessor::stopTracing()
+{
+    tracer.stop();
+}
+
+void ConvolutionPluginAudioProcessor::loadImpulseResponse(const juce::File& file)
+{
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+    
+    std::unique_ptr<juce::AudioFormatReader> reader (formatManager.createReaderFor(file));
+    
+    if (reader == nullptr)
+        return;
+    
+    // mono and untrimmed, as juce::dsp::Convolution used to load it, up to MAX_IMPULSE_SECONDS
+    auto maxLength = (juce::int64) juce::roundToInt(MAX_IMPULSE_SECONDS * reader->sampleRate);
+    auto length = static_cast<int> (juce::jmin(reader->lengthInSamples, maxLength));
+    impulseResponse.setSize(1, length);
+    reader->read(&impulseResponse, 0, length, 0, true, false);
+    impulseResponseSampleRate = reader->sampleRate;
+}
+
+void ConvolutionPluginAudioProcessor::loadEncoder(const juce::File& file)
+{
+    // a layout that can't be inverted would give inf or NaN filters, so it's rejected here
+    RigidSphereArray sphereArray;
+    auto result = RigidSphereArray::loadFromFile(file, sphereArray);
+    
+    if (result.wasOk() && (int) sphereArray.capsules.size() != ARRAY_MICROPHONES)
+        result = juce::Result::fail(file.getFileName() + " has " + juce::String((int) sphereArray.capsules.size())
+                                      + " capsules, the plugin has " + juce::String(ARRAY_MICROPHONES) + " inputs");
+    
+    if (result.wasOk())
+        result = RigidSphereEncoder::checkArray(sphereArray, ARRAY_ORDER);
+    
+    if (result.failed())
     {
-        convolver->loadImpulseResponse(dir.getChildFile("dev").getChildFile("resources").getChildFile("large_church.wav"), juce::dsp::Convolution::Stereo::no, juce::dsp::Convolution::Trim::no, 1024);
+        encoderStatus = result.getErrorMessage();
+        return;
     }
+    
+    encoder = std::make_unique<RigidSphereEncoder>(sphereArray, ARRAY_ORDER, ENCODER_MAX_GAIN_DB);
+    encoderStatus = juce::String(ARRAY_MICROPHONES) + " capsules, " + juce::String(sphereArray.radius * 1000.0, 1) + " mm";
 }
 
-ConvolutionPluginAudioProcessor::~ConvolutionPluginAudioProcessor()
+bool ConvolutionPluginAudioProcessor::isFilterSourceAvailable(FilterSource source) const noexcept
 {
+    return source == FilterSource::encoder ? encoder != nullptr : impulseResponse.getNumSamples() > 0;
+}
+
+bool ConvolutionPluginAudioProcessor::setFilterSource(FilterSource newSource)
+{
+    if (! isFilterSourceAvailable(newSource))
+        return false;
+    
+    if (newSource != filterSource)
+    {
+        filterSource = newSource;
+        prepareAgain();
+    }
+    
+    return true;
+}
+
+void ConvolutionPluginAudioProcessor::setTailSplitSeconds(double newSplitSeconds)
+{
+    jassert(newSplitSeconds > 0.0);
+    
+    if (newSplitSeconds != tailSplitSeconds)
+    {
+        tailSplitSeconds = newSplitSeconds;
+        prepareAgain();
+    }
+}
+
+void ConvolutionPluginAudioProcessor::prepareAgain()
+{
+    // the filters are only split and loaded in prepareToPlay, so run it again with the audio callback held off
+    if (! isPrepared)
+        return;
+    
+    suspendProcessing(true);
+    prepareToPlay(getSampleRate(), getBlockSize());
+    suspendProcessing(false);
 }
 
 //==============================================================================
@@ -109,9 +205,125 @@ void ConvolutionPluginAudioProcessor::changeProgramName (int index, const juce::
 //==============================================================================
 void ConvolutionPluginAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-    for (auto & convolver : convolvers)
+    juce::AudioBuffer<float> impulse;
+    activeEncoder = filterSource == FilterSource::encoder ? encoder.get() : nullptr;
+    
+    if (activeEncoder != nullptr)
+        activeEncoder->design(sampleRate, juce::nextPowerOfTwo(juce::roundToInt(ENCODER_FILTER_SECONDS * sampleRate)));
+    else
+        impulse = prepareImpulseResponse(sampleRate);
+    
+    auto filterLength = activeEncoder != nullptr ? activeEncoder->getFilterLength() : impulse.getNumSamples();
+    
+    // the host block size doesn't matter any more, the reblocker feeds the
+    // engine whatever partition size runs fastest on this machine
+    std::vector<int> fftOrders;
+    
+    for (auto size = MIN_PARTITION_SIZE / TAIL_DECIMATION; size <= MAX_PARTITION_SIZE; size *= 2)
+    {
+        fftOrders.push_back(juce::roundToInt(std::log2(2 * size)));
+    }
+    
+   #if CONVOLUTION_FFT_CALIBRATION
+    fftCalibration.run(fftOrders);
+   #else
+    fftCalibration.run(fftOrders, { &FFTBackend::getDefault() });
+   #endif
+    
+    // the reduced rate tail costs about as much as a full rate filter TAIL_DECIMATION times shorter
+    auto splitSamples = juce::roundToInt(tailSplitSeconds * sampleRate);
+    auto equivalentLength = juce::jmin(filterLength, splitSamples)
+                          + juce::jmax(0, filterLength - splitSamples) / TAIL_DECIMATION;
+    
+    // the cheapest partition size whose latency stays within the budget
+    auto latencyBudget = juce::roundToInt(MAX_LATENCY_SECONDS * sampleRate);
+    auto maxPartitionSize = juce::jlimit(MIN_PARTITION_SIZE, MAX_PARTITION_SIZE, juce::nextPowerOfTwo(latencyBudget + 1) / 2);
+    
+    // the pool lives until releaseResources, so each block only pays for waking it up
+    workers.prepare(numWorkers - 1, &tracer, 1);
+    
+    auto partitionSize = MatrixConvolver::findFastestPartitionSize(ARRAY_MICROPHONES, ARRAY_HARMONICS, equivalentLength,
+                                                                   MIN_PARTITION_SIZE, maxPartitionSize, fftCalibration,
+                                                                   workers.measureDispatchMicroseconds());
+    
+    engine.prepare(partitionSize, filterLength, splitSamples, TAIL_DECIMATION, fftCalibration, numWorkers);
+    reblocker.prepare(ARRAY_MICROPHONES, ARRAY_HARMONICS, partitionSize);
+    
+    // the encoding filters are delayed by half their length to make them causal
+    setLatencySamples(reblocker.getLatency() + (activeEncoder != nullptr ? activeEncoder->getDelay() : 0));
+    
+    // each harmonic only touches its own filters, so they can be loaded in parallel
+    std::vector<std::thread> threads;
+    
+    for (auto harm = 0; harm < ARRAY_HARMONICS; harm++)
+    {
+        threads.push_back(std::thread(&ConvolutionPluginAudioProcessor::loadFilters, this, harm, std::cref(impulse)));
+    }
+    
+    for (auto &th : threads)
+    {
+      th.join();
+    }
+    
+    // the omni filter of the first capsule stands for all of them
+    auto representative = std::vector<float>((size_t) filterLength);
+    
+    if (activeEncoder != nullptr)
+        activeEncoder->getFilter(0, 0, representative.data());
+    else if (filterLength > 0)
+        std::copy_n(impulse.getReadPointer(0), filterLength, representative.begin());
+    
+    tailCrossoverError = (float) MultirateConvolver::measureCrossoverError(representative.data(), filterLength,
+                                                                           splitSamples, TAIL_DECIMATION);
+    isPrepared = true;
+}
+
+juce::AudioBuffer<float> ConvolutionPluginAudioProcessor::prepareImpulseResponse(double sampleRate)
+{
+    // resample and normalise the impulse response like juce::dsp::Convolution does
+    auto impulse = impulseResponse;
+    
+    if (impulse.getNumSamples() > 0 && impulseResponseSampleRate != sampleRate)
     {
-        convolver->prepare({ sampleRate, (juce::uint32) samplesPerBlock, 1 });
+        auto ratio = impulseResponseSampleRate / sampleRate;
+        juce::MemoryAudioSource source (impulseResponse, true);
+        juce::ResamplingAudioSource resampler (&source, false, 1);
+        
+        impulse.setSize(1, juce::roundToInt(juce::jmax(1.0, impulseResponse.getNumSamples() / ratio)));
+        resampler.setResamplingRatio(ratio);
+        resampler.prepareToPlay(impulse.getNumSamples(), impulseResponseSampleRate);
+        resampler.getNextAudioBlock({ &impulse, 0, impulse.getNumSamples() });
+    }
+    
+    if (impulse.getNumSamples() == 0)
+        return impulse;
+    
+    auto magnitude = impulse.getRMSLevel(0, 0, impulse.getNumSamples()) * std::sqrt((float) impulse.getNumSamples());
+    
+    if (magnitude > 0.0f)
+        impulse.applyGain(0.125f / magnitude);
+    
+    return impulse;
+}
+
+void ConvolutionPluginAudioProcessor::loadFilters(int harmonic, const juce::AudioBuffer<float>& impulse)
+{
+    if (activeEncoder != nullptr)
+    {
+        auto filter = std::vector<float>((size_t) activeEncoder->getFilterLength());
+        
+        for (auto mic = 0; mic < ARRAY_MICROPHONES; mic++)
+        {
+            activeEncoder->getFilter(harmonic, mic, filter.data());
+            engine.setFilter(harmonic, mic, filter.data(), (int) filter.size());
+        }
+    }
+    else if (impulse.getNumSamples() > 0)
+    {
+        for (auto mic = 0; mic < ARRAY_MICROPHONES; mic++)
+        {
+            engine.setFilter(harmonic, mic, impulse.getReadPointer(0), impulse.getNumSamples());
+        }
     }
 }
 
@@ -119,6 +331,8 @@ void ConvolutionPluginAudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+    workers.release();
+    isPrepared = false;
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -141,6 +355,9 @@ bool ConvolutionPluginAudioProcessor::isBusesLayoutSupported (const BusesLayout&
 void ConvolutionPluginAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
     juce::ScopedNoDenormals noDenormals;
+    CONVOLUTION_TRACE_BIND(&tracer, 0);
+    CONVOLUTION_TRACE_SCOPE("processBlock");
+    
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
     jassert(totalNumInputChannels >= 64);
@@ -157,47 +374,49 @@ void ConvolutionPluginAudioProcessor::processBlock (juce::AudioBuffer<float>& bu
         buffer.clear (i, 0, buffer.getNumSamples());
     }
     
-    auto outBuffer = juce::AudioBuffer<float> {buffer.getNumChannels(), buffer.getNumSamples()};
-    outBuffer.clear();  // buffer data is not empty when initialized
-    
-    // create blocks for the buffers - no memory copied or created
-    auto inBlock = juce::dsp::AudioBlock<float>(buffer);
-    auto outBlock = juce::dsp::AudioBlock<float>(outBuffer);
-    
-    std::vector<std::thread> threads;
-    
-    if (reverbOn)
+    // the engine always runs on whole partitions, whatever the host's block size
+    reblocker.process(buffer, [this] (const juce::dsp::AudioBlock<float>& inBlock, juce::dsp::AudioBlock<float>& outBlock)
     {
-        for (auto harm = 0; harm < ARRAY_HARMONICS; harm++)
-        {
-            threads.push_back(std::thread(&ConvolutionPluginAudioProcessor::processHarmonic, this, harm, std::ref(inBlock), std::ref(outBlock)));
-        }
-        
-        for (auto &th : threads)
-        {
-          th.join();
-        }
-        
-        //outBuffer.applyGain(1.0f/64.0f);
-        buffer.makeCopyOf(outBuffer, true);
-    }
+        processEngineBlock(inBlock, outBlock);
+    });
     
     buffer.applyGain(outputVol);
 }
 
-void ConvolutionPluginAudioProcessor::processHarmonic(int harmonic, const juce::dsp::AudioBlock<float>& inBlock, juce::dsp::AudioBlock<float>& outBlock)
+void ConvolutionPluginAudioProcessor::processEngineBlock(const juce::dsp::AudioBlock<float>& inBlock, juce::dsp::AudioBlock<float>& outBlock)
 {
-    auto tmpBuffer = juce::AudioBuffer<float> {1, static_cast<int> (inBlock.getNumSamples())};
-    auto tmpBlock = juce::dsp::AudioBlock<float>(tmpBuffer);
+    CONVOLUTION_TRACE_SCOPE("engine block");
     
-    for (auto mic = 0; mic < ARRAY_MICROPHONES; mic++)
+    // the dry signal goes through the reblocker too, so the latency never changes
+    if (! reverbOn)
     {
-        auto idx = (harmonic * ARRAY_MICROPHONES) + mic;
-        auto singleInBlock = inBlock.getSingleChannelBlock(mic);
-        auto context = juce::dsp::ProcessContextNonReplacing<float>(singleInBlock, tmpBlock);
-        convolvers[idx]->process(context);
-        outBlock.getSingleChannelBlock(harmonic).add(tmpBlock);
+        outBlock.copyFrom(inBlock.getSubsetChannelBlock(0, outBlock.getNumChannels()));
+        return;
     }
+    
+    // forward transforms of all the mics, shared by every harmonic
+    engine.pushInputs(inBlock);
+    
+    // the multiply-accumulate in cache-sized tiles of bins and harmonics, then
+    // one inverse FFT per harmonic once every tile is done, shared with the pool
+    currentOutBlock = &outBlock;
+    workers.run(*this);
+    currentOutBlock = nullptr;
+    
+    engine.advance();
+}
+
+int ConvolutionPluginAudioProcessor::getNumTasks(int phase)
+{
+    return phase == 0 ? engine.getNumTiles() : ARRAY_HARMONICS;
+}
+
+void ConvolutionPluginAudioProcessor::runTask(int phase, int index) noexcept
+{
+    if (phase == 0)
+        engine.processTile(index);
+    else
+        engine.processOutput(index, currentOutBlock->getChannelPointer(index));
 }
 
 //==============================================================================
@@ -10,10 +10,17 @@
 
 #include <JuceHeader.h>
 
+#include "MultirateConvolver.h"
+#include "Reblocker.h"
+#include "RigidSphereEncoder.h"
+#include "TraceRecorder.h"
+#include "WorkerPool.h"
+
 //==============================================================================
 /**
 */
-class ConvolutionPluginAudioProcessor  : public juce::AudioProcessor
+class ConvolutionPluginAudioProcessor  : public juce::AudioProcessor,
+                                         private WorkerPool::Job
 {
 public:
     float outputVol {1.0};
@@ -56,16 +63,99 @@ public:
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
 
+    //==============================================================================
+    /** Where the filters of the engine come from: the room impulse response in
+        dev/resources/large_church.wav, or encoding filters computed for the
+        array described by dev/resources/capsules.txt.
+    */
+    enum class FilterSource
+    {
+        roomImpulse,
+        encoder
+    };
+    
+    /** Switches the filters, at once if the processor is prepared. Returns false,
+        and keeps the current filters, if that source couldn't be loaded.
+    */
+    bool setFilterSource(FilterSource newSource);
+    FilterSource getFilterSource() const noexcept { return filterSource; }
+    bool isFilterSourceAvailable(FilterSource source) const noexcept;
+    
+    /** The array the encoding filters are computed for, or why capsules.txt was rejected. */
+    const juce::String& getEncoderStatus() const noexcept { return encoderStatus; }
+    
+    /** Where the filters are split between the full rate and the reduced rate
+        engine, at once if the processor is prepared.
+    */
+    void setTailSplitSeconds(double newSplitSeconds);
+    double getTailSplitSeconds() const noexcept { return tailSplitSeconds; }
+    
+    //==============================================================================
+    HugePageArena::Footprint getMemoryFootprint() const { return engine.getMemoryFootprint(); }
+    
+    /** The error of the reduced rate tail in dB, or minus infinity if the whole filter runs at full rate. */
+    float getTailCrossoverError() const noexcept { return tailCrossoverError; }
+    
+    /** Records the scheduling of the audio and harmonic threads to a trace file on the desktop. */
+    bool startTracing();
+    void stopTracing();
+    bool isTracing() const noexcept { return tracer.isRecording(); }
+
 private:
     //==============================================================================
     static constexpr int ARRAY_MICROPHONES = 64;
     static constexpr int ARRAY_HARMONICS = 36;
     static constexpr int ARRAY_ORDER = 5;
     
-    std::vector<std::unique_ptr<juce::dsp::Convolution>> convolvers;
-    juce::dsp::ConvolutionMessageQueue messageQueue;
+    // longer than the tail split, so that room responses reach the reduced rate engine.
+    // Every second past the split costs about 220 MB of filter spectra at 48 kHz.
+    static constexpr double MAX_IMPULSE_SECONDS = 0.5;
+    
+    // range of the engine's partition size, which is also the plugin's latency
+    static constexpr int MIN_PARTITION_SIZE = 64;
+    static constexpr int MAX_PARTITION_SIZE = 4096;
+    static constexpr double MAX_LATENCY_SECONDS = 0.012;
+    
+    // the filters are convolved at a quarter of the sample rate after the split, by default this time
+    static constexpr double DEFAULT_TAIL_SPLIT_SECONDS = 0.08;
+    static constexpr int TAIL_DECIMATION = 4;
+    
+    // analytic encoding filters, when they're the filter source
+    static constexpr double ENCODER_MAX_GAIN_DB = 20.0;
+    static constexpr double ENCODER_FILTER_SECONDS = 0.01;
+    
+    // one thread per core shares out the engine's tiles and inverse FFTs,
+    // the audio thread and numWorkers - 1 pool threads
+    const int numWorkers { juce::jlimit(1, ARRAY_HARMONICS, juce::SystemStats::getNumCpus()) };
+    
+    MultirateConvolver engine { ARRAY_MICROPHONES, ARRAY_HARMONICS };
+    std::atomic<float> tailCrossoverError { -std::numeric_limits<float>::infinity() };
+    Reblocker reblocker;
+    FFTCalibration fftCalibration;
+    TraceRecorder tracer { numWorkers };
+    WorkerPool workers;
+    juce::dsp::AudioBlock<float>* currentOutBlock { nullptr };
+    
+    std::unique_ptr<RigidSphereEncoder> encoder;
+    juce::String encoderStatus;
+    juce::AudioBuffer<float> impulseResponse;
+    double impulseResponseSampleRate { 0.0 };
+    
+    FilterSource filterSource { FilterSource::roomImpulse };
+    double tailSplitSeconds { DEFAULT_TAIL_SPLIT_SECONDS };
+    RigidSphereEncoder* activeEncoder { nullptr };
+    bool isPrepared { false };
+    
+    void loadEncoder(const juce::File& file);
+    void loadImpulseResponse(const juce::File& file);
+    juce::AudioBuffer<float> prepareImpulseResponse(double sampleRate);
+    void loadFilters(int harmonic, const juce::AudioBuffer<float>& impulse);
+    void prepareAgain();
+    void processEngineBlock(const juce::dsp::AudioBlock<float>& inBlock, juce::dsp::AudioBlock<float>& outBlock);
     
-    void processHarmonic(int harmonic, const juce::dsp::AudioBlock<float>& inBlock, juce::dsp::AudioBlock<float>& outBlock);
+    // the engine block as a WorkerPool::Job: the tiles, then the harmonics
+    int getNumTasks(int phase) override;
+    void runTask(int phase, int index) noexcept override;
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ConvolutionPluginAudioProcessor)
 };
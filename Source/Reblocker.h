@@ -0,0 +1,85 @@
+/*
+  ==============================================================================
+
+    Decouples the host's block size from the block size of the engine.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    Collects host samples until a whole engine block is available, hands it to
+    the engine, and plays the engine's output back one block later.
+
+    The host can call with any number of samples, including odd or varying
+    sizes, while the engine always sees exactly getBlockSize() samples. This
+    costs a fixed latency of one engine block, which the processor reports to
+    the host. Everything is allocated in prepare(), never while processing.
+*/
+class Reblocker
+{
+public:
+    void prepare (int numInputChannels, int numOutputChannels, int engineBlockSize)
+    {
+        blockSize = engineBlockSize;
+        inputs.setSize (numInputChannels, blockSize);
+        outputs.setSize (numOutputChannels, blockSize);
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        inputs.clear();
+        outputs.clear();
+        position = 0;
+    }
+
+    int getBlockSize() const noexcept   { return blockSize; }
+    int getLatency() const noexcept     { return blockSize; }
+
+    /** Replaces the samples of the buffer by the engine's output, delayed by one
+        engine block. processEngineBlock is called with (const AudioBlock<float>& in,
+        AudioBlock<float>& out) every time a full block of input is available.
+    */
+    template <typename EngineCallback>
+    void process (juce::AudioBuffer<float>& buffer, EngineCallback&& processEngineBlock)
+    {
+        const auto numInputs = juce::jmin (inputs.getNumChannels(), buffer.getNumChannels());
+        const auto numOutputs = juce::jmin (outputs.getNumChannels(), buffer.getNumChannels());
+
+        for (auto start = 0; start < buffer.getNumSamples();)
+        {
+            const auto numSamples = juce::jmin (buffer.getNumSamples() - start, blockSize - position);
+
+            // inputs first, the outputs overwrite the same channels of the host buffer
+            for (auto ch = 0; ch < numInputs; ++ch)
+                inputs.copyFrom (ch, position, buffer, ch, start, numSamples);
+
+            for (auto ch = 0; ch < numOutputs; ++ch)
+                buffer.copyFrom (ch, start, outputs, ch, position, numSamples);
+
+            for (auto ch = numOutputs; ch < buffer.getNumChannels(); ++ch)
+                buffer.clear (ch, start, numSamples);
+
+            position += numSamples;
+            start += numSamples;
+
+            if (position == blockSize)
+            {
+                auto inBlock = juce::dsp::AudioBlock<float> (inputs);
+                auto outBlock = juce::dsp::AudioBlock<float> (outputs);
+
+                processEngineBlock (inBlock, outBlock);
+                position = 0;
+            }
+        }
+    }
+
+private:
+    juce::AudioBuffer<float> inputs, outputs;
+    int blockSize = 0, position = 0;
+};
@@ -0,0 +1,397 @@
+/*
+  ==============================================================================
+
+    Analytic encoding filters for a microphone array on a rigid sphere.
+
+  ==============================================================================
+*/
+
+#include <thread>
+
+#include "RigidSphereEncoder.h"
+#include "FFTBackend.h"
+
+namespace
+{
+    constexpr double speedOfSound = 343.0;
+
+
+    /** The largest ratio between the eigenvalues of Y^T Y that checkArray() accepts.
+        The weakest harmonic would be picked up 20 dB below the strongest one.
+    */
+    constexpr double maxConditionNumber = 100.0;
+
+    /** The eigenvalues of a symmetric matrix, with cyclic Jacobi rotations. */
+    std::vector<double> getEigenvalues (std::vector<std::vector<double>> a)
+    {
+        const auto size = a.size();
+
+        for (auto sweep = 0; sweep < 50; ++sweep)
+        {
+            auto offDiagonal = 0.0, diagonal = 0.0;
+
+            for (size_t i = 0; i < size; ++i)
+                for (size_t j = 0; j < size; ++j)
+                    (i == j ? diagonal : offDiagonal) += a[i][j] * a[i][j];
+
+            if (offDiagonal <= 1.0e-24 * diagonal)
+                break;
+
+            for (size_t p = 0; p + 1 < size; ++p)
+            {
+                for (size_t q = p + 1; q < size; ++q)
+                {
+                    if (a[p][q] == 0.0)
+                        continue;
+
+                    // the rotation that zeroes a[p][q]
+                    const auto theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                    const auto t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs (theta) + std::sqrt (theta * theta + 1.0));
+                    const auto c = 1.0 / std::sqrt (t * t + 1.0);
+                    const auto s = t * c;
+
+                    for (size_t k = 0; k < size; ++k)
+                    {
+                        const auto kp = a[k][p], kq = a[k][q];
+                        a[k][p] = c * kp - s * kq;
+                        a[k][q] = s * kp + c * kq;
+                    }
+
+                    for (size_t k = 0; k < size; ++k)
+                    {
+                        const auto pk = a[p][k], qk = a[q][k];
+                        a[p][k] = c * pk - s * qk;
+                        a[q][k] = s * pk + c * qk;
+                    }
+                }
+            }
+        }
+
+        std::vector<double> eigenvalues (size);
+
+        for (size_t i = 0; i < size; ++i)
+            eigenvalues[i] = a[i][i];
+
+        return eigenvalues;
+    }
+}
+
+//==============================================================================
+juce::Result RigidSphereArray::loadFromFile (const juce::File& file, RigidSphereArray& result)
+{
+    if (! file.existsAsFile())
+        return juce::Result::fail (file.getFileName() + " not found");
+
+    result = {};
+
+    juce::StringArray lines;
+    lines.addLines (file.loadFileAsString());
+
+    for (auto i = 0; i < lines.size(); ++i)
+    {
+        auto text = lines[i].trim();
+
+        if (text.isEmpty() || text.startsWithChar ('#'))
+            continue;
+
+        auto tokens = juce::StringArray::fromTokens (text, " \t,", "");
+        tokens.removeEmptyStrings();
+
+        if (tokens.size() == 2 && tokens[0] == "radius")
+            result.radius = tokens[1].getDoubleValue();
+        else if (tokens.size() == 2)
+            result.capsules.push_back ({ juce::degreesToRadians (tokens[0].getDoubleValue()),
+                                         juce::degreesToRadians (tokens[1].getDoubleValue()) });
+        else
+            return juce::Result::fail (file.getFileName() + " line " + juce::String (i + 1) + " isn't a capsule or the radius");
+    }
+
+    if (result.radius <= 0.0)
+        return juce::Result::fail (file.getFileName() + " has no radius");
+
+    return juce::Result::ok();
+}
+
+//==============================================================================
+RigidSphereEncoder::RigidSphereEncoder (const RigidSphereArray& sphereArray, int ambisonicOrder, double maxGainDecibels)
+    : array (sphereArray), order (ambisonicOrder), maxGain (juce::Decibels::decibelsToGain (maxGainDecibels))
+{
+    // the elimination below would divide by a near-zero pivot
+    jassert (checkArray (array, order).wasOk());
+
+    computePseudoInverse();
+}
+
+juce::Result RigidSphereEncoder::checkArray (const RigidSphereArray& array, int order)
+{
+    const auto numHarmonics = (order + 1) * (order + 1);
+    const auto numCapsules = (int) array.capsules.size();
+
+    if (numCapsules < numHarmonics)
+        return juce::Result::fail (juce::String (numCapsules) + " capsules can't resolve order " + juce::String (order)
+                                     + ", that takes at least " + juce::String (numHarmonics));
+
+    if (array.radius <= 0.0)
+        return juce::Result::fail ("The sphere radius isn't positive");
+
+    const auto y = getHarmonicMatrix (array, order);
+    std::vector<std::vector<double>> yty ((size_t) numHarmonics, std::vector<double> ((size_t) numHarmonics));
+
+    for (size_t i = 0; i < yty.size(); ++i)
+        for (size_t j = 0; j < yty.size(); ++j)
+            for (auto& row : y)
+                yty[i][j] += row[i] * row[j];
+
+    const auto eigenvalues = getEigenvalues (yty);
+    const auto range = std::minmax_element (eigenvalues.begin(), eigenvalues.end());
+
+    if (! (*range.first > *range.second / maxConditionNumber))
+        return juce::Result::fail ("The capsules can't tell every harmonic up to order " + juce::String (order)
+                                     + " apart, some are duplicated or too close together");
+
+    return juce::Result::ok();
+}
+
+std::vector<std::vector<double>> RigidSphereEncoder::getHarmonicMatrix (const RigidSphereArray& array, int order)
+{
+    const auto numHarmonics = (order + 1) * (order + 1);
+    std::vector<std::vector<double>> y (array.capsules.size(), std::vector<double> ((size_t) numHarmonics));
+
+    for (size_t q = 0; q < array.capsules.size(); ++q)
+    {
+        for (auto h = 0; h < numHarmonics; ++h)
+        {
+            const auto n = (int) std::sqrt ((double) h);
+            const auto& capsule = array.capsules[q];
+            y[q][(size_t) h] = getRealSphericalHarmonic (n, h - n * n - n, capsule.azimuth, capsule.elevation);
+        }
+    }
+
+    return y;
+}
+
+void RigidSphereEncoder::computePseudoInverse()
+{
+    const auto numHarmonics = getNumHarmonics();
+    const auto numCapsules = getNumCapsules();
+
+    const auto y = getHarmonicMatrix (array, order);
+
+    // solve (Y^T Y) X = Y^T with Gauss-Jordan elimination, on an augmented matrix
+    std::vector<std::vector<double>> a ((size_t) numHarmonics, std::vector<double> ((size_t) (numHarmonics + numCapsules)));
+
+    for (auto i = 0; i < numHarmonics; ++i)
+    {
+        for (auto j = 0; j < numHarmonics; ++j)
+        {
+            auto sum = 0.0;
+
+            for (auto q = 0; q < numCapsules; ++q)
+                sum += y[(size_t) q][(size_t) i] * y[(size_t) q][(size_t) j];
+
+            a[(size_t) i][(size_t) j] = sum;
+        }
+
+        for (auto q = 0; q < numCapsules; ++q)
+            a[(size_t) i][(size_t) (numHarmonics + q)] = y[(size_t) q][(size_t) i];
+    }
+
+    for (auto col = 0; col < numHarmonics; ++col)
+    {
+        auto pivot = col;
+
+        for (auto row = col + 1; row < numHarmonics; ++row)
+            if (std::abs (a[(size_t) row][(size_t) col]) > std::abs (a[(size_t) pivot][(size_t) col]))
+                pivot = row;
+
+        std::swap (a[(size_t) col], a[(size_t) pivot]);
+
+        // a singular Y^T Y means the capsules can't tell some harmonics apart
+        jassert (std::abs (a[(size_t) col][(size_t) col]) > 1.0e-12);
+
+        const auto scale = 1.0 / a[(size_t) col][(size_t) col];
+
+        for (auto& value : a[(size_t) col])
+            value *= scale;
+
+        for (auto row = 0; row < numHarmonics; ++row)
+        {
+            if (row == col)
+                continue;
+
+            const auto factor = a[(size_t) row][(size_t) col];
+
+            for (size_t j = 0; j < a[(size_t) row].size(); ++j)
+                a[(size_t) row][j] -= factor * a[(size_t) col][j];
+        }
+    }
+
+    pseudoInverse.assign ((size_t) numHarmonics, {});
+
+    for (auto h = 0; h < numHarmonics; ++h)
+        pseudoInverse[(size_t) h].assign (a[(size_t) h].begin() + numHarmonics, a[(size_t) h].end());
+}
+
+//==============================================================================
+void RigidSphereEncoder::design (double sampleRate, int newFilterLength)
+{
+    jassert (juce::isPowerOfTwo (newFilterLength));
+
+    filterLength = newFilterLength;
+
+    const auto numBins = filterLength / 2 + 1;
+    std::vector<std::vector<FFTPlan::Complex>> spectra ((size_t) (order + 1), std::vector<FFTPlan::Complex> ((size_t) numBins));
+
+    // each bin is independent, so every core gets a contiguous range of them
+    auto designBins = [&] (int startBin, int endBin)
+    {
+        for (auto k = startBin; k < endBin; ++k)
+        {
+            const auto kr = juce::MathConstants<double>::twoPi * k * sampleRate / filterLength * array.radius / speedOfSound;
+
+            // a delay of half the filter length, which is -1 to the power k
+            const auto delay = (k % 2 == 0) ? 1.0 : -1.0;
+
+            for (auto n = 0; n <= order; ++n)
+            {
+                // inverse of the mode strength, relative to the omni at DC, soft-limited to maxGain
+                std::complex<double> gain;
+
+                if (k == 0)
+                {
+                    gain = (n == 0) ? 1.0 : 0.0;
+                }
+                else
+                {
+                    gain = 4.0 * juce::MathConstants<double>::pi / getModeStrength (n, kr);
+
+                    const auto magnitude = std::abs (gain);
+                    gain *= 2.0 * maxGain / (juce::MathConstants<double>::pi * magnitude)
+                              * std::atan (juce::MathConstants<double>::pi * magnitude / (2.0 * maxGain));
+                }
+
+                // from orthonormal to SN3D, and the 4 pi of the mode strength
+                gain *= std::sqrt (4.0 * juce::MathConstants<double>::pi / (2 * n + 1)) / (4.0 * juce::MathConstants<double>::pi) * delay;
+
+                spectra[(size_t) n][(size_t) k] = FFTPlan::Complex ((float) gain.real(), (float) gain.imag());
+            }
+        }
+    };
+
+    const auto numThreads = juce::jlimit (1, numBins, juce::SystemStats::getNumCpus());
+    std::vector<std::thread> threads;
+
+    for (auto t = 0; t < numThreads; ++t)
+    {
+        threads.push_back (std::thread (designBins, numBins * t / numThreads, numBins * (t + 1) / numThreads));
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    const auto plan = FFTBackend::getDefault().getPlan (juce::roundToInt (std::log2 (filterLength)));
+    const auto scratch = plan->createScratch();
+
+    radialFilters.assign ((size_t) (order + 1), std::vector<float> ((size_t) filterLength));
+
+    for (auto n = 0; n <= order; ++n)
+    {
+        auto& filter = radialFilters[(size_t) n];
+        plan->inverse (spectra[(size_t) n].data(), filter.data(), *scratch);
+
+        // fade the ends, where the truncated ringing of the high orders lives
+        const auto fadeLength = filterLength / 8;
+
+        for (auto i = 0; i < fadeLength; ++i)
+        {
+            const auto fade = (float) (0.5 - 0.5 * std::cos (juce::MathConstants<double>::pi * i / fadeLength));
+            filter[(size_t) i] *= fade;
+            filter[(size_t) (filterLength - 1 - i)] *= fade;
+        }
+    }
+}
+
+void RigidSphereEncoder::getFilter (int harmonic, int capsule, float* destination) const noexcept
+{
+    const auto n = (int) std::sqrt ((double) harmonic);
+
+    juce::FloatVectorOperations::multiply (destination, radialFilters[(size_t) n].data(),
+                                           (float) pseudoInverse[(size_t) harmonic][(size_t) capsule], filterLength);
+}
+
+//==============================================================================
+double RigidSphereEncoder::getRealSphericalHarmonic (int n, int m, double azimuth, double elevation)
+{
+    const auto absM = std::abs (m);
+    const auto x = std::sin (elevation);
+    const auto s = std::cos (elevation);
+
+    // associated Legendre function P_n^|m| (x) without the Condon-Shortley phase
+    auto pmm = 1.0;
+
+    for (auto i = 1; i <= absM; ++i)
+        pmm *= (2 * i - 1) * s;
+
+    auto legendre = pmm;
+
+    if (n > absM)
+    {
+        auto previous = pmm;
+        auto current = x * (2 * absM + 1) * pmm;
+
+        for (auto l = absM + 2; l <= n; ++l)
+        {
+            const auto next = ((2 * l - 1) * x * current - (l + absM - 1) * previous) / (l - absM);
+            previous = current;
+            current = next;
+        }
+
+        legendre = current;
+    }
+
+    // orthonormal: sqrt ((2n + 1) / 4 pi * (n - |m|)! / (n + |m|)!)
+    auto factorialRatio = 1.0;
+
+    for (auto i = n - absM + 1; i <= n + absM; ++i)
+        factorialRatio /= i;
+
+    const auto norm = std::sqrt ((2 * n + 1) / (4.0 * juce::MathConstants<double>::pi) * factorialRatio);
+
+    if (m == 0)
+        return norm * legendre;
+
+    return juce::MathConstants<double>::sqrt2 * norm * legendre
+             * (m > 0 ? std::cos (m * azimuth) : std::sin (absM * azimuth));
+}
+
+std::complex<double> RigidSphereEncoder::getModeStrength (int n, double kr)
+{
+    // spherical Bessel functions of the first and second kind up to order n + 1
+    std::vector<double> j ((size_t) (n + 2)), y ((size_t) (n + 2));
+
+    j[0] = std::sin (kr) / kr;
+    y[0] = -std::cos (kr) / kr;
+    j[1] = std::sin (kr) / (kr * kr) - std::cos (kr) / kr;
+    y[1] = -std::cos (kr) / (kr * kr) - std::sin (kr) / kr;
+
+    for (auto l = 1; l <= n; ++l)
+    {
+        j[(size_t) (l + 1)] = (2 * l + 1) / kr * j[(size_t) l] - j[(size_t) (l - 1)];
+        y[(size_t) (l + 1)] = (2 * l + 1) / kr * y[(size_t) l] - y[(size_t) (l - 1)];
+    }
+
+    // derivative of the outgoing Hankel function h_n = j_n - i y_n, the sign
+    // matching the e^-iwt kernel of the FFT
+    const auto derivative = [n] (const std::vector<double>& f)
+    {
+        return (n * (n > 0 ? f[(size_t) (n - 1)] : 0.0) - (n + 1) * f[(size_t) (n + 1)]) / (2 * n + 1);
+    };
+
+    const std::complex<double> hankelDerivative (derivative (j), -derivative (y));
+
+    // rigid sphere: 4 pi i^n (j_n - j_n' / h_n' h_n), which the Wronskian reduces to
+    // 4 pi i^n (-i) / ((kr)^2 h_n')
+    const auto iPowerN = std::pow (std::complex<double> (0.0, 1.0), n);
+
+    return 4.0 * juce::MathConstants<double>::pi * iPowerN * std::complex<double> (0.0, -1.0) / (kr * kr * hankelDerivative);
+}
@@ -0,0 +1,98 @@
+/*
+  ==============================================================================
+
+    Analytic encoding filters for a microphone array on a rigid sphere.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <complex>
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    The geometry of a spherical microphone array: capsule directions in radians
+    (azimuth counter-clockwise from the front, elevation up from the horizon) and
+    the radius of the rigid sphere they sit on.
+*/
+struct RigidSphereArray
+{
+    struct Capsule
+    {
+        double azimuth, elevation;
+    };
+
+    std::vector<Capsule> capsules;
+    double radius = 0.0;
+
+    /** Reads a text file with a "radius <metres>" line followed by one capsule
+        per line as "<azimuth> <elevation>" in degrees. Lines starting with #
+        are comments. Fails with a description if the file is missing or malformed.
+    */
+    static juce::Result loadFromFile (const juce::File& file, RigidSphereArray& result);
+};
+
+//==============================================================================
+/**
+    Computes the filters that turn the capsule signals of a RigidSphereArray
+    into ambisonic signals (ACN channel order, SN3D normalisation).
+
+    Each filter is the product of a frequency independent spherical harmonic
+    pseudo-inverse, Y+ = (Y^T Y)^-1 Y^T, and the inverse of the rigid sphere
+    mode strength of its order. That inverse is soft-limited to maxGainDecibels,
+    because it grows without bound at low frequencies for the higher orders.
+
+    The radial filters are designed on the frequency grid of the filter length,
+    with the bins shared out between all the cores, and given a delay of half
+    the filter length so that they're causal.
+*/
+class RigidSphereEncoder
+{
+public:
+    /** The array has to pass checkArray() for the order. */
+    RigidSphereEncoder (const RigidSphereArray& array, int order, double maxGainDecibels);
+
+    /** Fails with a description if the capsules can't resolve every harmonic
+        up to the order, i.e. if there are too few of them or Y^T Y is singular
+        or badly conditioned, which duplicate or clustered capsules cause.
+    */
+    static juce::Result checkArray (const RigidSphereArray& array, int order);
+
+    int getNumHarmonics() const noexcept    { return (order + 1) * (order + 1); }
+    int getNumCapsules() const noexcept     { return (int) array.capsules.size(); }
+
+    /** Designs the radial filters for a sample rate. Not for the audio thread. */
+    void design (double sampleRate, int filterLength);
+
+    int getFilterLength() const noexcept    { return filterLength; }
+
+    /** The delay of every filter, in samples, which the host has to be told about. */
+    int getDelay() const noexcept           { return filterLength / 2; }
+
+    /** Writes the filter from one capsule to one harmonic, getFilterLength() samples. */
+    void getFilter (int harmonic, int capsule, float* destination) const noexcept;
+
+private:
+    static double getRealSphericalHarmonic (int n, int m, double azimuth, double elevation);
+    static std::complex<double> getModeStrength (int n, double kr);
+
+    /** Y, one row per capsule and one column per harmonic. */
+    static std::vector<std::vector<double>> getHarmonicMatrix (const RigidSphereArray& array, int order);
+
+    void computePseudoInverse();
+
+    const RigidSphereArray array;
+    const int order;
+    const double maxGain;
+
+    int filterLength = 0;
+
+    /** [harmonic][capsule] */
+    std::vector<std::vector<double>> pseudoInverse;
+
+    /** [order][sample] */
+    std::vector<std::vector<float>> radialFilters;
+};
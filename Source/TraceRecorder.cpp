@@ -0,0 +1,195 @@
+/*
+  ==============================================================================
+
+    Opt-in recorder of begin/end events on the audio and worker threads,
+    written out as Chrome / Perfetto trace-event JSON.
+
+  ==============================================================================
+*/
+
+#include "TraceRecorder.h"
+
+namespace
+{
+    struct ThreadBinding
+    {
+        TraceRecorder* recorder = nullptr;
+        int lane = 0;
+    };
+
+    thread_local ThreadBinding threadBinding;
+}
+
+//==============================================================================
+TraceRecorder::TraceRecorder (int numLanes, int eventsPerLane)
+    : juce::Thread ("Trace writer")
+{
+    for (auto i = 0; i < numLanes; ++i)
+    {
+        lanes.push_back (std::make_unique<Lane> (eventsPerLane));
+        lanes.back()->name = "lane " + juce::String (i);
+    }
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    stop();
+}
+
+void TraceRecorder::setLaneName (int lane, const juce::String& name)
+{
+    lanes[(size_t) lane]->name = name;
+}
+
+//==============================================================================
+bool TraceRecorder::start (const juce::File& file)
+{
+    stop();
+
+    file.deleteFile();
+    stream = std::make_unique<juce::FileOutputStream> (file);
+
+    if (! stream->openedOk())
+    {
+        stream.reset();
+        return false;
+    }
+
+    // throw away whatever was recorded after the previous trace was finished
+    writeEvents (true);
+
+    *stream << "{\"traceEvents\":[\n";
+    firstEvent = true;
+
+    for (size_t i = 0; i < lanes.size(); ++i)
+    {
+        *stream << (firstEvent ? "" : ",\n")
+                << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << (int) i
+                << ",\"args\":{\"name\":\"" << lanes[i]->name << "\"}}";
+        firstEvent = false;
+    }
+
+    startTicks = juce::Time::getHighResolutionTicks();
+    recording = true;
+    startThread();
+
+    return true;
+}
+
+void TraceRecorder::stop()
+{
+    if (stream == nullptr)
+        return;
+
+    recording = false;
+    stopThread (1000);
+
+    writeEvents (false);
+
+    *stream << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    stream->flush();
+    stream.reset();
+}
+
+//==============================================================================
+void TraceRecorder::bindThread (TraceRecorder* recorder, int lane) noexcept
+{
+    jassert (recorder == nullptr || juce::isPositiveAndBelow (lane, (int) recorder->lanes.size()));
+
+    threadBinding.recorder = recorder;
+    threadBinding.lane = lane;
+}
+
+TraceRecorder::ScopedBinding::ScopedBinding (TraceRecorder* recorder, int lane) noexcept
+    : previousRecorder (threadBinding.recorder), previousLane (threadBinding.lane)
+{
+    bindThread (recorder, lane);
+}
+
+TraceRecorder::ScopedBinding::~ScopedBinding() noexcept
+{
+    bindThread (previousRecorder, previousLane);
+}
+
+bool TraceRecorder::isThreadRecording() noexcept
+{
+    auto* recorder = threadBinding.recorder;
+    return recorder != nullptr && recorder->isRecording();
+}
+
+void TraceRecorder::record (const char* name, char phase, int index) noexcept
+{
+    // an end event is always kept, so that scopes stay balanced across stop()
+    if (phase == 'E' ? threadBinding.recorder == nullptr : ! isThreadRecording())
+        return;
+
+    auto& lane = *threadBinding.recorder->lanes[(size_t) threadBinding.lane];
+
+    int start1, size1, start2, size2;
+    lane.fifo.prepareToWrite (1, start1, size1, start2, size2);
+
+    if (size1 + size2 == 0)
+    {
+        lane.numDropped.fetch_add (1, std::memory_order_relaxed);
+        return;
+    }
+
+    lane.events[(size_t) (size1 > 0 ? start1 : start2)] = { name, juce::Time::getHighResolutionTicks(), index, phase };
+    lane.fifo.finishedWrite (1);
+}
+
+//==============================================================================
+void TraceRecorder::run()
+{
+    while (! threadShouldExit())
+    {
+        writeEvents (false);
+        wait (50);
+    }
+}
+
+void TraceRecorder::writeEvents (bool discard)
+{
+    const auto microsecondsPerTick = 1.0e6 / (double) juce::Time::getHighResolutionTicksPerSecond();
+
+    auto writeEvent = [&] (const char* name, char phase, int tid, juce::int64 ticks, const juce::String& args)
+    {
+        *stream << (firstEvent ? "" : ",\n")
+                << "{\"name\":\"" << name << "\",\"cat\":\"convolution\",\"ph\":\"" << juce::String::charToString (phase) << "\""
+                << (phase == 'i' ? ",\"s\":\"t\"" : "")
+                << ",\"pid\":1,\"tid\":" << tid
+                << ",\"ts\":" << juce::String ((double) (ticks - startTicks) * microsecondsPerTick, 3)
+                << (args.isEmpty() ? juce::String() : ",\"args\":{" + args + "}")
+                << "}";
+        firstEvent = false;
+    };
+
+    for (size_t i = 0; i < lanes.size(); ++i)
+    {
+        auto& lane = *lanes[i];
+
+        int start1, size1, start2, size2;
+        lane.fifo.prepareToRead (lane.fifo.getNumReady(), start1, size1, start2, size2);
+
+        if (! discard)
+        {
+            for (auto block : { std::make_pair (start1, size1), std::make_pair (start2, size2) })
+            {
+                for (auto j = block.first; j < block.first + block.second; ++j)
+                {
+                    const auto& event = lane.events[(size_t) j];
+                    writeEvent (event.name, event.phase, (int) i, event.ticks,
+                                event.index >= 0 ? "\"index\":" + juce::String (event.index) : juce::String());
+                }
+            }
+        }
+
+        lane.fifo.finishedRead (size1 + size2);
+
+        const auto numDropped = lane.numDropped.exchange (0);
+
+        if (numDropped > 0 && ! discard)
+            writeEvent ("events dropped", 'i', (int) i, juce::Time::getHighResolutionTicks(),
+                        "\"count\":" + juce::String (numDropped));
+    }
+}
@@ -0,0 +1,147 @@
+/*
+  ==============================================================================
+
+    Opt-in recorder of begin/end events on the audio and worker threads,
+    written out as Chrome / Perfetto trace-event JSON.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <atomic>
+
+/** Set to 0 to compile every trace point out completely. */
+#ifndef CONVOLUTION_TRACING
+ #define CONVOLUTION_TRACING 1
+#endif
+
+//==============================================================================
+/**
+    Records timestamped events into one preallocated lock-free FIFO per lane,
+    and a background thread turns them into a trace-event JSON file that
+    chrome://tracing or ui.perfetto.dev open directly.
+
+    A lane is a timeline in the viewer: lane 0 is the audio thread, the others
+    are the workers. A thread binds itself to a lane with a ScopedBinding, after
+    which the trace macros on that thread record into that lane until the
+    binding goes out of scope. Only one thread may be bound to a lane at a time.
+
+    When the recorder isn't running, a trace point costs a thread-local read
+    and a relaxed atomic load.
+*/
+class TraceRecorder  : private juce::Thread
+{
+public:
+    explicit TraceRecorder (int numLanes, int eventsPerLane = 8192);
+    ~TraceRecorder() override;
+
+    /** Starts writing a new trace to the given file. Call from the message thread. */
+    bool start (const juce::File& file);
+
+    /** Stops recording and finishes the file. */
+    void stop();
+
+    bool isRecording() const noexcept   { return recording.load (std::memory_order_relaxed); }
+
+    /** Names a lane in the trace viewer. Call before start(). */
+    void setLaneName (int lane, const juce::String& name);
+
+    //==============================================================================
+    /** Makes the calling thread record into one lane of a recorder, and puts
+        the thread's previous binding back when it goes out of scope. Threads
+        the plugin doesn't own, like the host's audio thread, are never left
+        pointing at a recorder that may be deleted.
+    */
+    class ScopedBinding
+    {
+    public:
+        ScopedBinding (TraceRecorder* recorder, int lane) noexcept;
+        ~ScopedBinding() noexcept;
+
+    private:
+        TraceRecorder* const previousRecorder;
+        const int previousLane;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedBinding)
+    };
+
+    static void begin (const char* name, int index = -1) noexcept    { record (name, 'B', index); }
+    static void end (const char* name, int index = -1) noexcept      { record (name, 'E', index); }
+    static void instant (const char* name, int index = -1) noexcept  { record (name, 'i', index); }
+
+    /** Records a begin event now and the matching end event when it goes out of scope. */
+    class Scope
+    {
+    public:
+        explicit Scope (const char* eventName, int eventIndex = -1) noexcept
+            : name (eventName), index (eventIndex), active (isThreadRecording())
+        {
+            if (active)
+                begin (name, index);
+        }
+
+        ~Scope() noexcept
+        {
+            if (active)
+                end (name, index);
+        }
+
+    private:
+        const char* const name;
+        const int index;
+        const bool active;
+
+        JUCE_DECLARE_NON_COPYABLE (Scope)
+    };
+
+private:
+    //==============================================================================
+    /** Names must be string literals, only the pointer is stored. */
+    struct Event
+    {
+        const char* name;
+        juce::int64 ticks;
+        int index;
+        char phase;
+    };
+
+    struct Lane
+    {
+        explicit Lane (int capacity) : fifo (capacity), events ((size_t) capacity) {}
+
+        juce::AbstractFifo fifo;
+        std::vector<Event> events;
+        std::atomic<int> numDropped { 0 };
+        juce::String name;
+    };
+
+    static void bindThread (TraceRecorder* recorder, int lane) noexcept;
+    static bool isThreadRecording() noexcept;
+    static void record (const char* name, char phase, int index) noexcept;
+
+    void run() override;
+    void writeEvents (bool discard);
+
+    std::vector<std::unique_ptr<Lane>> lanes;
+    std::atomic<bool> recording { false };
+
+    std::unique_ptr<juce::FileOutputStream> stream;
+    juce::int64 startTicks = 0;
+    bool firstEvent = true;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TraceRecorder)
+};
+
+//==============================================================================
+#if CONVOLUTION_TRACING
+ #define CONVOLUTION_TRACE_SCOPE(name, ...)   TraceRecorder::Scope JUCE_JOIN_MACRO (traceScope_, __LINE__) (name, ##__VA_ARGS__)
+ #define CONVOLUTION_TRACE_INSTANT(name, ...) TraceRecorder::instant (name, ##__VA_ARGS__)
+ #define CONVOLUTION_TRACE_BIND(recorder, lane) TraceRecorder::ScopedBinding JUCE_JOIN_MACRO (traceBinding_, __LINE__) (recorder, lane)
+#else
+ #define CONVOLUTION_TRACE_SCOPE(name, ...)
+ #define CONVOLUTION_TRACE_INSTANT(name, ...)
+ #define CONVOLUTION_TRACE_BIND(recorder, lane)
+#endif
@@ -0,0 +1,170 @@
+/*
+  ==============================================================================
+
+    Persistent worker threads that share out the engine's work every block.
+
+  ==============================================================================
+*/
+
+#include "WorkerPool.h"
+
+//==============================================================================
+class WorkerPool::Worker  : public juce::Thread
+{
+public:
+    Worker (WorkerPool& workerPool, int workerIndex, TraceRecorder* traceRecorder, int traceLane)
+        : juce::Thread ("Convolution worker " + juce::String (workerIndex)),
+          pool (workerPool), index (workerIndex), recorder (traceRecorder), lane (traceLane)
+    {
+    }
+
+    ~Worker() override
+    {
+        signalThreadShouldExit();
+        wakeUp.signal();
+        stopThread (1000);
+    }
+
+    void run() override
+    {
+        CONVOLUTION_TRACE_BIND (recorder, lane);
+        juce::ignoreUnused (recorder, lane);
+
+        for (;;)
+        {
+            wakeUp.wait();
+
+            if (threadShouldExit())
+                return;
+
+            CONVOLUTION_TRACE_INSTANT ("wakeup", index);
+            pool.work (getGeneration (pool.claims.load (std::memory_order_acquire)));
+        }
+    }
+
+    juce::WaitableEvent wakeUp;
+
+private:
+    WorkerPool& pool;
+    const int index;
+    TraceRecorder* const recorder;
+    const int lane;
+};
+
+//==============================================================================
+WorkerPool::WorkerPool() = default;
+
+WorkerPool::~WorkerPool()
+{
+    release();
+}
+
+void WorkerPool::prepare (int numThreads, TraceRecorder* recorder, int firstLane)
+{
+    if (numThreads == getNumThreads())
+        return;
+
+    release();
+
+    for (auto i = 0; i < numThreads; ++i)
+    {
+        workers.push_back (std::make_unique<Worker> (*this, i, recorder, firstLane + i));
+
+        // the audio thread waits for the workers, so they have to run at its priority
+        workers.back()->startThread (juce::Thread::realtimeAudioPriority);
+    }
+}
+
+void WorkerPool::release()
+{
+    workers.clear();
+}
+
+//==============================================================================
+void WorkerPool::run (Job& newJob) noexcept
+{
+    const auto numFirst = newJob.getNumTasks (0);
+    const auto numSecond = newJob.getNumTasks (1);
+
+    jassert (numFirst + numSecond <= 0xffff);
+
+    // the previous job is complete, so nothing can touch these until the new claims are published
+    job = &newJob;
+    numCompleted.store (0, std::memory_order_relaxed);
+
+    const auto generation = (getGeneration (claims.load (std::memory_order_relaxed)) + 1) & 0xffff;
+    claims.store ((generation << 48) | ((juce::uint64) numFirst << 32) | ((juce::uint64) numSecond << 16),
+                  std::memory_order_release);
+
+    CONVOLUTION_TRACE_INSTANT ("dispatch");
+
+    for (auto& worker : workers)
+        worker->wakeUp.signal();
+
+    work (generation);
+
+    while (numCompleted.load (std::memory_order_acquire) < numFirst + numSecond)
+        juce::Thread::yield();
+}
+
+void WorkerPool::work (juce::uint64 generation) noexcept
+{
+    for (;;)
+    {
+        auto state = claims.load (std::memory_order_acquire);
+
+        if (getGeneration (state) != generation)
+            return;
+
+        const auto numFirst = getNumFirst (state);
+        const auto next = getNext (state);
+
+        if (next >= numFirst + getNumSecond (state))
+            return;
+
+        if (! claims.compare_exchange_weak (state, state + 1, std::memory_order_acq_rel))
+            continue;
+
+        if (next < numFirst)
+        {
+            job->runTask (0, next);
+        }
+        else
+        {
+            // the barrier: every task of the first phase has been claimed by now, and
+            // the threads running them never wait, so this can't deadlock
+            while (numCompleted.load (std::memory_order_acquire) < numFirst)
+                juce::Thread::yield();
+
+            job->runTask (1, next - numFirst);
+        }
+
+        numCompleted.fetch_add (1, std::memory_order_release);
+    }
+}
+
+//==============================================================================
+double WorkerPool::measureDispatchMicroseconds()
+{
+    struct EmptyJob  : public Job
+    {
+        explicit EmptyJob (int tasks) : numTasks (tasks) {}
+
+        int getNumTasks (int) override             { return numTasks; }
+        void runTask (int, int) noexcept override  {}
+
+        const int numTasks;
+    };
+
+    EmptyJob emptyJob (getNumThreads() + 1);
+    auto best = std::numeric_limits<double>::max();
+
+    for (auto i = 0; i < 8; ++i)
+    {
+        const auto start = juce::Time::getMillisecondCounterHiRes();
+        run (emptyJob);
+        best = juce::jmin (best, juce::Time::getMillisecondCounterHiRes() - start);
+    }
+
+    return best * 1000.0;
+}
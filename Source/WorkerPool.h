@@ -0,0 +1,82 @@
+/*
+  ==============================================================================
+
+    Persistent worker threads that share out the engine's work every block.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "TraceRecorder.h"
+
+//==============================================================================
+/**
+    A fixed set of threads, started once in prepareToPlay() and parked on an
+    event between blocks, so that dispatching a block costs a wake-up rather
+    than creating and joining threads.
+
+    run() hands out the tasks of a Job to the workers and to the calling thread,
+    which takes tasks too. A Job has two phases with a barrier between them:
+    no task of the second phase starts before every task of the first one is
+    done. Tasks are claimed from a shared counter, so a worker that wakes up
+    late just finds less work left.
+*/
+class WorkerPool
+{
+public:
+    /** The work of one run(). Tasks of the same phase may run in parallel. */
+    struct Job
+    {
+        virtual ~Job() = default;
+
+        virtual int getNumTasks (int phase) = 0;
+        virtual void runTask (int phase, int index) noexcept = 0;
+    };
+
+    WorkerPool();
+    ~WorkerPool();
+
+    /** Starts numThreads workers, in addition to the thread that calls run().
+        Worker i records into lane firstLane + i of the recorder. Does nothing
+        if the pool already has that many threads.
+    */
+    void prepare (int numThreads, TraceRecorder* recorder, int firstLane);
+
+    /** Stops and deletes the workers. */
+    void release();
+
+    int getNumThreads() const noexcept   { return (int) workers.size(); }
+
+    /** Runs every task of the job and returns once they're all done. */
+    void run (Job& job) noexcept;
+
+    /** The fastest of a few runs of an empty job with a task per thread in
+        each phase, i.e. the cost of waking the workers and the barrier, in
+        microseconds.
+    */
+    double measureDispatchMicroseconds();
+
+private:
+    //==============================================================================
+    class Worker;
+
+    void work (juce::uint64 generation) noexcept;
+
+    /** The generation of the job, the number of tasks in each phase and the
+        next task to claim, in one word. A worker still holding on to an old
+        job can't claim a task of the next one.
+    */
+    static juce::uint64 getGeneration (juce::uint64 claims) noexcept    { return claims >> 48; }
+    static int getNumFirst (juce::uint64 claims) noexcept               { return (int) ((claims >> 32) & 0xffff); }
+    static int getNumSecond (juce::uint64 claims) noexcept              { return (int) ((claims >> 16) & 0xffff); }
+    static int getNext (juce::uint64 claims) noexcept                   { return (int) (claims & 0xffff); }
+
+    std::atomic<juce::uint64> claims { 0 };
+    std::atomic<int> numCompleted { 0 };
+    Job* job = nullptr;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WorkerPool)
+};